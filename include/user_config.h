@@ -6,14 +6,13 @@
 
 
 
-#define DS1820_PIN 12
-
 #define APP_NAME        "Remote Temperature Sensor"
 #define APP_VER_MAJ		1
 #define APP_VER_MIN		2
 #define APP_VER_REV		0
 
 #define MQTT_CLIENT_TYPE    	"env"
+#define MQTT_DIAG_TYPE    	"diag"
 
 //#define DHT_TYPE		DS18B20
 //#define DHT_TYPE		DHT11
@@ -22,27 +21,73 @@
 #define DHT_MUX		PERIPHS_IO_MUX_GPIO4_U
 #define DHT_FUNC		FUNC_GPIO4
 #define DHT_PIN		GPIO_ID_PIN(4)
+#define DHT_NAME		"dht"
+
+//#define DS1820_ENABLE	/*second sensor, a DS18B20 reported as an object named DS1820_NAME*/
+#define DS1820_MUX		PERIPHS_IO_MUX_MTDI_U
+#define DS1820_FUNC		FUNC_GPIO12
+#define DS1820_PIN		GPIO_ID_PIN(12)
+#define DS1820_NAME		"ds18b20"
+
+#define DHT_SAMPLES		1		/*readings per report, each more keeps every wake up 2 s longer on a DHT22, the median of those that agree gets published*/
+#define DHT_SAMPLE_BUDGET	5000	/*millisecond, no read starts later*/
+#define DHT_OUTLIER		200		/*1/100 degree or percent off the median*/
 
 //#define NO_SLEEP
 
 
 #ifdef NO_SLEEP
-	#define REPORT_INTERVAL	600000
+	#define REPORT_INTERVAL	600000	/* milliseconds, first interval, then REPORT_INTERVAL_MIN to _MAX */
+
+	#define NO_SLEEP_TYPE	LIGHT_SLEEP_T	/* NONE_SLEEP_T, MODEM_SLEEP_T or LIGHT_SLEEP_T between reports */
+	#define NO_SLEEP_LISTEN_INTERVAL	3	/* DTIM periods the station sleeps through, 1 to 10 */
+	#define NO_SLEEP_KEEPALIVE	120	/* seconds, MQTT keepalive while the session idles */
+	#define WIFI_CHECK_INTERVAL	30000	/* milliseconds, link check while connected */
 
 	#define LED_PIN       	2  // GPIO 2 = Green Led (0 = On, 1 = Off)
 	#define LED_MUX       	PERIPHS_IO_MUX_GPIO2_U
 	#define LED_FUNC      	FUNC_GPIO2
 
 #else
-	#define DEEP_SLEEP 600000000	/* microseconds, sleep for 10 minutes */
+	#define DEEP_SLEEP 600000000	/* microseconds, first sleep, then REPORT_INTERVAL_MIN to _MAX */
+	#define RADIO_ON_BUDGET	20000	/* milliseconds, give up the wake after this */
+	#define WAKE_MIN_SLEEP	1000	/* milliseconds, a slot closer than this is skipped */
 #endif
 
+#define REPORT_DEADBAND_TEMPERATURE	20	/*1/100 degree, smaller changes are not sent*/
+#define REPORT_DEADBAND_HUMIDITY	100	/*1/100 percent, smaller changes are not sent*/
+#define REPORT_HEARTBEAT	3600	/*second, sent even without a change after this*/
+#define REPORT_DIAG_INTERVAL	21600	/*second, sensor health goes to the diag topic this often*/
+#define REPORT_INTERVAL_MIN	60		/*second, shortest interval while readings move fast*/
+#define REPORT_INTERVAL_MAX	3600	/*second, longest interval while readings are stable, at most 4294 for deep sleep*/
+#define REPORT_VDD_LOW		3000	/*mV, the interval doubles below this, needs byte 107 of esp_init_data_default.bin at 255*/
+#define REPORT_VDD_CRITICAL	2800	/*mV, the interval quadruples below this*/
+#define REPORT_VDD_BROWNOUT	2600	/*mV, last gasp below this, then only the heartbeat*/
+
+#define RFCAL_WAKES			24		/*wakes with RF, a full RF calibration at least this often*/
+#define RFCAL_TEMPERATURE	500		/*1/100 degree, change since the last calibration that forces one*/
+#define RFCAL_TPW_MIN		20		/*1/4 dBm, lowest TX power, 0 to 82*/
+#define RFCAL_TPW_MAX		82		/*1/4 dBm, highest TX power and the one after a failed association*/
+#define RFCAL_TPW_STEP		8		/*1/4 dBm, change per wake*/
+#define RFCAL_RSSI_TARGET	-70		/*dBm, TX power goes up below this*/
+#define RFCAL_RSSI_MARGIN	10		/*dB, TX power goes down above RFCAL_RSSI_TARGET plus this*/
+
 
 
 #define MQTT_HOST     			"192.168.13.100"
 #define MQTT_PORT     			1883
 #define MQTT_KEEPALIVE    		30  /*second*/
-#define MQTT_RECONNECT_TIMEOUT  	10  /*second*/
+#define MQTT_RECONNECT_TIMEOUT  	10  /*second, doubles with every failed attempt*/
+#define MQTT_RECONNECT_MAX		300  /*second*/
+#define WIFI_RETRY_TIMEOUT		2000  /*millisecond, doubles with every failed attempt*/
+#define WIFI_RETRY_MAX			60000  /*millisecond*/
+#define WIFI_LEASE_TTL			3600  /*second, a DHCP lease is reused this long, keep it below the lease time of the AP*/
+#define WIFI_ARP_PROBE_TIME		200  /*millisecond, wait for an answer to the ARP request for a cached address*/
+#define MQTT_FLUSH_TIMEOUT		5000  /*millisecond, deadline of MQTT_FlushAndSleep*/
+#define EPOCH_SNTP_SERVER		"pool.ntp.org"
+#define EPOCH_SYNC_INTERVAL		86400  /*second, SNTP this often, and after a cold boot*/
+#define EPOCH_SYNC_TIMEOUT		5000  /*millisecond, wait for an SNTP answer*/
+#define MQTT_DNS_TTL			3600  /*second, lifetime of a cached broker address*/
 #define MQTT_CLEAN_SESSION 		1
 #define MQTT_BUF_SIZE   			1024
 #define MQTT_CLIENT_ID    		"ESP"
@@ -51,6 +96,15 @@
 
 #define MQTT_TOPIC_BASE			"/angst/devices"
 
+//#define MQTT_PIPELINE			MQTT_PIPELINE_DISCONNECT	/* send the reading together with CONNECT */
+
+//#define MQTTSN_ENABLE				/* publish over MQTT-SN (UDP) instead of MQTT */
+#define MQTTSN_HOST				MQTT_HOST
+#define MQTTSN_PORT				1884
+#define MQTTSN_TOPIC_ID			1	/* pre-defined topic id, mapped on the gateway */
+#define MQTTSN_DIAG_TOPIC_ID	2	/* pre-defined topic id for the diagnostics */
+#define MQTTSN_QOS				-1	/* -1 sends without connecting to the gateway */
+
 
 
 
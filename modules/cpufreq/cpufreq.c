@@ -0,0 +1,53 @@
+#include <user_interface.h>
+#include <osapi.h>
+#include <c_types.h>
+#include "user_config.h"
+#include "cpufreq.h"
+
+static uint8_t phases;		/* CPUFREQ_TLS and CPUFREQ_ENCODE bits */
+static uint32 since;		/* system_get_time of the last switch, boot is at 80 MHz */
+static uint32 spent[2];		/* us at CPUFREQ_LOW and CPUFREQ_HIGH up to since */
+
+static void ICACHE_FLASH_ATTR update(void) {
+	uint8_t mhz = phases ? CPUFREQ_HIGH : CPUFREQ_LOW;
+	uint8_t current = system_get_cpu_freq();
+	uint32 now;
+
+	if (mhz == current) {
+		return;
+	}
+	now = system_get_time();
+	spent[current == CPUFREQ_HIGH] += now - since;
+	since = now;
+	system_update_cpu_freq(mhz);
+	DEBUG("CPU: %d MHz\r\n", mhz);
+}
+
+/*
+ * Runs at CPUFREQ_HIGH until the phase is released.
+ */
+void ICACHE_FLASH_ATTR CPUFREQ_Boost(uint8_t phase) {
+	phases |= phase;
+	update();
+}
+
+/*
+ * Ends a phase, back at CPUFREQ_LOW once no other one runs. Releasing a
+ * phase that did not start does nothing.
+ */
+void ICACHE_FLASH_ATTR CPUFREQ_Release(uint8_t phase) {
+	phases &= ~phase;
+	update();
+}
+
+/*
+ * Time in us spent at mhz since boot.
+ */
+uint32 ICACHE_FLASH_ATTR CPUFREQ_Time(uint8_t mhz) {
+	uint32 time = spent[mhz == CPUFREQ_HIGH];
+
+	if (system_get_cpu_freq() == mhz) {
+		time += system_get_time() - since;
+	}
+	return time;
+}
@@ -0,0 +1,23 @@
+#ifndef MODULES_INCLUDE_CPUFREQ_H_
+#define MODULES_INCLUDE_CPUFREQ_H_
+
+#include <c_types.h>
+
+/*
+ * CPU frequency policy: 160 MHz while any CPU heavy phase is running,
+ * 80 MHz while waiting. os_delay_us, the DHT and 1-Wire timings follow
+ * the frequency, but it must not change during a transfer, so only event
+ * callbacks switch.
+ */
+
+#define CPUFREQ_TLS		0x01	/* TLS handshake */
+#define CPUFREQ_ENCODE	0x02	/* building and queueing a publish */
+
+#define CPUFREQ_LOW		80
+#define CPUFREQ_HIGH	160
+
+void ICACHE_FLASH_ATTR CPUFREQ_Boost(uint8_t phase);
+void ICACHE_FLASH_ATTR CPUFREQ_Release(uint8_t phase);
+uint32 ICACHE_FLASH_ATTR CPUFREQ_Time(uint8_t mhz);
+
+#endif /* MODULES_INCLUDE_CPUFREQ_H_ */
@@ -27,474 +27,384 @@
 
 #include "user_config.h"
 #include "dht.h"
+#include "onewire.h"
+#include "rtcmem.h"
 
 // list of commands DS18B20:
 
+#define PHASE_IDLE	0
+#define PHASE_START	1
+#define PHASE_POLL	2
+
+static dht_sample_cb sample_cb = NULL;
+static struct dht_sensor *sample_sensors;
+static uint8_t sample_sensor_count;
+static uint8_t sample_pending;
+static uint32_t sample_start;
+static uint32_t sample_budget;
+static uint8_t sample_want;
+static BOOL stats_loaded = FALSE;
+
+#define COUNT(counter)	do { if ((counter) + 1 != 0) (counter)++; } while (0)
+
+#ifdef DRIVER_DS18B20
+static void ICACHE_FLASH_ATTR ds18b20_init(struct dht_sensor *sensor) {
+	// Needs an external pull-up
+	PIN_FUNC_SELECT(sensor->mux, sensor->func);
+}
 
-static struct dht_sensor_data reading = { .success = 0 };
+static BOOL ICACHE_FLASH_ATTR ds18b20_start(struct dht_sensor *sensor, uint32_t *wait_ms) {
+	if(OW_Reset(sensor->pin) != 0) {
+		ERROR("Reset #1 failed\r\n");
+		COUNT(sensor->stats.resets);
+		return FALSE;
+	}
 
-enum DHTType sensor_type;
+	OW_WriteByte(sensor->pin, DS1820_SKIP_ROM);  // skip ROM command
+	OW_WriteByte(sensor->pin, DS1820_CONVERT_T); // convert T command
 
+	// Conversion time at 12 bit
+	*wait_ms = 750;
+	return TRUE;
+}
 
-/***
- * CRC Table and code from Maxim AN 162:
- *  http://www.maximintegrated.com/en/app-notes/index.mvp/id/162
- */
-unsigned const char dscrc_table[] = { 0, 94, 188, 226, 97, 63, 221, 131, 194, 156, 126, 32, 163, 253, 31, 65, 157, 195, 33, 127, 252, 162, 64, 30, 95, 1, 227, 189, 62, 96, 130, 220, 35, 125, 159, 193, 66, 28, 254, 160, 225, 191, 93, 3, 128, 222, 60, 98, 190, 224, 2, 92, 223, 129, 99, 61, 124, 34, 192, 158, 29, 67, 161, 255, 70, 24, 250, 164, 39, 121, 155, 197, 132, 218, 56, 102, 229, 187, 89, 7, 219, 133, 103, 57, 186, 228, 6, 88, 25, 71, 165, 251, 120, 38, 196, 154, 101, 59, 217, 135, 4, 90, 184, 230, 167, 249, 27, 69, 198, 152, 122, 36, 248, 166, 68, 26, 153, 199, 37, 123, 58, 100, 134, 216, 91, 5, 231, 185, 140, 210, 48, 110, 237, 179, 81, 15, 78, 16, 242, 172, 47, 113, 147, 205, 17, 79, 173, 243, 112, 46, 204, 146, 211, 141, 111, 49, 178, 236, 14, 80, 175, 241, 19, 77, 206, 144, 114, 44, 109, 51, 209, 143, 12, 82, 176, 238, 50, 108, 142, 208, 83, 13, 239, 177, 240, 174, 76, 18, 145, 207, 45, 115, 202, 148, 118, 40, 171, 245, 23, 73, 8, 86, 180, 234, 105, 55, 213, 139, 87, 9, 235, 181, 54, 104, 138, 212,
-		149, 203, 41, 119, 244, 170, 72, 22, 233, 183, 85, 11, 136, 214, 52, 106, 43, 117, 151, 201, 74, 20, 246, 168, 116, 42, 200, 150, 21, 75, 169, 247, 182, 232, 10, 84, 215, 137, 107, 53 };
+static BOOL ICACHE_FLASH_ATTR ds18b20_poll(struct dht_sensor *sensor) {
+	struct dht_sensor_data *reading = &sensor->reading;
 
-unsigned char dowcrc = 0;
+	reading->success = 0;
+	if(OW_Reset(sensor->pin) != 0) {
+		ERROR("Reset #2 failed\r\n");
+		COUNT(sensor->stats.resets);
+		return FALSE;
+	}
+	OW_WriteByte(sensor->pin, DS1820_SKIP_ROM);		// skip ROM command
+	OW_WriteByte(sensor->pin, DS1820_READ_SCRATCHPAD); // read scratchpad command
 
-unsigned char ow_crc(unsigned char x) {
-	dowcrc = dscrc_table[dowcrc ^ x];
-	return dowcrc;
-}
+	uint8_t get[9];
+	OW_Read(sensor->pin, get, sizeof(get));
 
-//End of Maxim AN162 code
-
-unsigned char ROM_NO[8];
-uint8_t LastDiscrepancy;
-uint8_t LastFamilyDiscrepancy;
-uint8_t LastDeviceFlag;
-
-void write_bit(int bit) {
-	os_delay_us(1);
-	//Let bus get pulled high
-	GPIO_DIS_OUTPUT(DHT_PIN);
-
-	if (bit) {
-		//5us low pulse
-		GPIO_OUTPUT_SET(DHT_PIN, 0);
-		os_delay_us(5);
-		//let bus go high again (device should read about 30us later)
-		GPIO_DIS_OUTPUT(DHT_PIN);// was OW_RLS	// input
-		os_delay_us(55);
-	} else {
-		//55us low
-		GPIO_OUTPUT_SET(DHT_PIN, 0);
-		os_delay_us(55);
-		//5us high
-		GPIO_DIS_OUTPUT(DHT_PIN);// was OW_RLS	// input
-		os_delay_us(5);
+	DEBUG("ScratchPAD DATA = %X %X %X %X %X %X %X %X %X\r\n",get[8],get[7],get[6],get[5],get[4],get[3],get[2],get[1],get[0]);
+
+	uint8_t crc = OW_Crc8(get, 8);
+	if (get[8] != crc) {
+		ERROR("CRC check failed: %02X %02X", get[8], crc);
+		COUNT(sensor->stats.checksum);
+		return FALSE;
 	}
-}
+	uint8_t temp_msb = get[1]; // Sign byte + lsbit
+	uint8_t temp_lsb = get[0]; // Temp data plus lsb
 
-//#####################################################################
+	// two's complement in 1/16 degree
+	int16_t temp = (int16_t) (temp_msb << 8 | temp_lsb);
 
-int read_bit() {
-	int bit = 0;
-	os_delay_us(1);
-	//Pull bus low for 15us
-	GPIO_OUTPUT_SET(DHT_PIN, 0);
-	os_delay_us(15);
+	reading->success = 1;
+	reading->temperature = DHTScaleDS18B20(temp);
+	reading->humidity = 0;
 
-	//Allow device to control bu
-	GPIO_DIS_OUTPUT(DHT_PIN);
-	os_delay_us(5);
+	INFO("Got a DS18B20 Reading on GPIO%d: %d/100\r\n", sensor->pin, reading->temperature);
 
-	//Read value
-	if (GPIO_INPUT_GET(DHT_PIN)) {		 //was if (OW_IN)
-		bit = 1;
-	}
-	//Wait for end of bit
-	os_delay_us(40);
-	return bit;
+	return TRUE;
 }
 
-//#####################################################################
-
-void write_byte(uint8_t byte) {
-	int i;
-	for (i = 0; i < 8; i++) {
-		write_bit(byte & 1);
-		byte >>= 1;
-	}
+static const struct dht_driver ds18b20_driver ICACHE_RODATA_ATTR = {
+	// The conversion time is in ds18b20_start
+	"DS18B20", 1, ds18b20_init, ds18b20_start, ds18b20_poll
+};
+#endif /* DRIVER_DS18B20 */
+
+#ifdef DRIVER_DHT1122
+static void ICACHE_FLASH_ATTR dht1122_init(struct dht_sensor *sensor) {
+	PIN_FUNC_SELECT(sensor->mux, sensor->func);
+	PIN_PULLUP_EN(sensor->mux);
+	GPIO_DIS_OUTPUT(sensor->pin);
 }
 
-//#####################################################################
+static BOOL ICACHE_FLASH_ATTR dht1122_start(struct dht_sensor *sensor, uint32_t *wait_ms) {
+	// Start signal, the DHT11 wants at least 18ms of low
+	GPIO_OUTPUT_SET(sensor->pin, 0);
+	*wait_ms = 20;
+	return TRUE;
+}
 
-uint8_t read_byte() {
-	unsigned int i;
-	uint8_t byte = 0;
-	for (i = 0; i < 8; i++) {
-		byte >>= 1;
-		if (read_bit())
-			byte |= 0x80;
+/*
+ * Waits while the pin is at level. Returns how long in us, or -1 after
+ * DHT_PULSE_TIMEOUT.
+ */
+static int32_t ICACHE_FLASH_ATTR pulse_width(uint8_t pin, uint8_t level) {
+	uint32_t start = system_get_time();
+	uint32_t width = 0;
+
+	while (GPIO_INPUT_GET(pin) == level) {
+		width = system_get_time() - start;
+		if (width > DHT_PULSE_TIMEOUT) {
+			return -1;
+		}
 	}
-	return byte;
+	return width;
 }
 
-int reset(void) {
-	//Hold the bus low for 500us
-	GPIO_OUTPUT_SET(DHT_PIN, 0); //was OW_LO
-	os_delay_us(500);
+static BOOL ICACHE_FLASH_ATTR dht1122_poll(struct dht_sensor *sensor) {
+	struct dht_sensor_data *reading = &sensor->reading;
+	uint8_t pin = sensor->pin;
+	uint8_t highs[40];
+	uint8_t threshold, margin;
+	int32_t response, width;
+	int checksum = 0;
+	int bin;
+	uint8_t data[5];
+	int i;
 
-	//Give up control of the bus and wait for a device to reply
-	GPIO_DIS_OUTPUT(DHT_PIN);//set to input
-	os_delay_us(80);
+	reading->success = 0;
 
-	//The bus should be low if the device is present:
-	if (GPIO_INPUT_GET(DHT_PIN)) {
-		ERROR("No device found.\r\n");
-		//No device
-		return 1;
-	}
+	// Release the bus, the pull-up ends the start signal
+	GPIO_DIS_OUTPUT(pin);
 
-	//The device should have stopped pulling the bus now:
-	os_delay_us(300);
-	if (!GPIO_INPUT_GET(DHT_PIN)) {
-		ERROR("Invalid state. Bus should be high.\r\n");
-		//Something's wrong, the bus should be high
-		return 2;
+	// Response: the sensor pulls low for 80us, then high for 80us
+	if (pulse_width(pin, 1) < 0 || pulse_width(pin, 0) < 0 || (response = pulse_width(pin, 1)) < 0) {
+		INFO("Failed to get reading, dying\r\n");
+		COUNT(sensor->stats.short_reads);
+		return FALSE;
 	}
 
-	//All good.
-	return 0;
-}
-
-struct dht_sensor_data* readDS18B20(void) {
-	if(reset() != 0) {
-		ERROR("Reset #1 failed\r\n");
-		reading.success = 0;
-		return &reading;
+	// Each bit is 50us of low and a high of ~26us for 0 or ~70us for 1
+	for (i = 0; i < 40; i++) {
+		if (pulse_width(pin, 0) < 0 || (width = pulse_width(pin, 1)) < 0) {
+			INFO("Got too few bits: %d should be at least 40\r\n", i);
+			COUNT(sensor->stats.short_reads);
+			return FALSE;
+		}
+		highs[i] = width < 0xFF ? width : 0xFF;
+		bin = width / DHT_HISTOGRAM_WIDTH;
+		COUNT(sensor->stats.histogram[bin < DHT_HISTOGRAM_BINS ? bin : DHT_HISTOGRAM_BINS - 1]);
 	}
 
-	write_byte(DS1820_SKIP_ROM);  // skip ROM command
-	write_byte(DS1820_CONVERT_T); // convert T command
-
-	os_delay_us(750);
-	if(reset() != 0) {
-		ERROR("Reset #2 failed\r\n");
-		reading.success = 0;
-		return &reading;
-	}
-	write_byte(DS1820_SKIP_ROM);		// skip ROM command
-	write_byte(DS1820_READ_SCRATCHPAD); // read scratchpad command
-
-	uint8_t get[10];
-	uint8_t k = 0;
-
-	get[0] = read_byte();
-	get[1] = read_byte();
-	get[2] = read_byte();
-	get[3] = read_byte();
-	get[4] = read_byte();
-	get[5] = read_byte();
-	get[6] = read_byte();
-	get[7] = read_byte();
-	get[8] = read_byte();
-	get[9] = read_byte();
+	threshold = DHTBitThreshold(highs, response < 0xFF ? response : 0xFF, &margin);
+	sensor->stats.threshold = threshold;
+	sensor->stats.margin = margin;
+	DEBUG("DHT: bit threshold %dus, margin %dus\r\n", threshold, margin);
 
-	DEBUG("ScratchPAD DATA = %X %X %X %X %X %X %X %X %X\r\n",get[8],get[7],get[6],get[5],get[4],get[3],get[2],get[1],get[0]);
+	DHTBits(highs, threshold, data);
 
-	dowcrc = 0;
-	ow_crc(get[0]);
-	ow_crc(get[1]);
-	ow_crc(get[2]);
-	ow_crc(get[3]);
-	ow_crc(get[4]);
-	ow_crc(get[5]);
-	ow_crc(get[6]);
-	ow_crc(get[7]);
-
-	if (get[8] != dowcrc) {
-		ERROR("CRC check failed: %02X %02X", get[8], dowcrc);
-		reading.success = 0;
-		return &reading;
+	checksum = (data[0] + data[1] + data[2] + data[3]) & 0xFF;
+	INFO("DHT: %02x %02x %02x %02x [%02x] CS: %02x\r\n", data[0], data[1], data[2], data[3], data[4], checksum);
+	if (data[4] == checksum) {
+		// checksum is valid
+		reading->temperature = DHTTemperature(data);
+		reading->humidity = DHTHumidity(data);
+		reading->success = 1;
+	} else {
+		INFO("Checksum was incorrect. Expected %d but got %d\r\n", data[4], checksum);
+		COUNT(sensor->stats.checksum);
 	}
-	uint8_t temp_msb = get[1]; // Sign byte + lsbit
-	uint8_t temp_lsb = get[0]; // Temp data plus lsb
+	return reading->success;
+}
 
-	uint16_t temp = temp_msb << 8 | temp_lsb;
+// Only one of DHT11 and DHT22 per build, see DHT_TYPE
+static const struct dht_driver dht1122_driver ICACHE_RODATA_ATTR = {
+#if DHT_TYPE == DHT11
+	"DHT11", 1000, dht1122_init, dht1122_start, dht1122_poll
+#else
+	"DHT22", 2000, dht1122_init, dht1122_start, dht1122_poll
+#endif
+};
+#endif /* DRIVER_DHT1122 */
+
+static const struct dht_driver *ICACHE_FLASH_ATTR driver_for(uint8_t type) {
+#ifdef DRIVER_DHT1122
+	if (type == DHT_TYPE) {
+		return &dht1122_driver;
+	}
+#endif
+#ifdef DRIVER_DS18B20
+	if (type == DS18B20) {
+		return &ds18b20_driver;
+	}
+#endif
+	return NULL;
+}
 
-	reading.success = 1;
-	reading.temperature = (temp * 625.0) / 10000;
+/*
+ * The stats of the first DHT_STATS_SENSORS sensors live in RTC memory
+ */
+static void ICACHE_FLASH_ATTR stats_load(void) {
+	struct dht_stats stats[DHT_STATS_SENSORS];
+	uint8_t i;
 
-	INFO("Got a DS18B20 Reading: %d.%d\r\n", (int) reading.temperature, (int) (reading.temperature - (int) reading.temperature) * 100);
+	if (stats_loaded) {
+		return;
+	}
+	stats_loaded = TRUE;
+	if (!RTC_Load(RTC_SLOT_STATS, stats, sizeof(stats))) {
+		return;
+	}
+	for (i = 0; i < sample_sensor_count && i < DHT_STATS_SENSORS; i++) {
+		sample_sensors[i].stats = stats[i];
+	}
+}
 
-	return &reading;
+static void ICACHE_FLASH_ATTR stats_save(void) {
+	struct dht_stats stats[DHT_STATS_SENSORS];
+	uint8_t i;
 
+	os_memset(stats, 0, sizeof(stats));
+	for (i = 0; i < sample_sensor_count && i < DHT_STATS_SENSORS; i++) {
+		stats[i] = sample_sensors[i].stats;
+	}
+	RTC_Save(RTC_SLOT_STATS, stats, sizeof(stats));
 }
 
-void reset_search() {
-	// reset the search state
-	LastDiscrepancy = 0;
-	LastDeviceFlag = FALSE;
-	LastFamilyDiscrepancy = 0;
-
-	ROM_NO[7] = 0;
-	ROM_NO[6] = 0;
-	ROM_NO[5] = 0;
-	ROM_NO[4] = 0;
-	ROM_NO[3] = 0;
-	ROM_NO[2] = 0;
-	ROM_NO[1] = 0;
-	ROM_NO[0] = 0;
+static void ICACHE_FLASH_ATTR sample_step(struct dht_sensor *sensor);
+
+static void ICACHE_FLASH_ATTR sample_arm(struct dht_sensor *sensor, uint8_t phase, uint32_t ms) {
+	sensor->phase = phase;
+	os_timer_disarm(&sensor->timer);
+	os_timer_setfn(&sensor->timer, (os_timer_func_t *) sample_step, sensor);
+	os_timer_arm(&sensor->timer, ms > 0 ? ms : 1, 0);
 }
-//
-// Perform a search. If this function returns a '1' then it has
-// enumerated the next device and you may retrieve the ROM from the
-// OneWire::address variable. If there are no devices, no further
-// devices, or something horrible happens in the middle of the
-// enumeration then a 0 is returned.  If a new device is found then
-// its address is copied to newAddr.  Use OneWire::reset_search() to
-// start over.
-//
-// --- Replaced by the one from the Dallas Semiconductor web site ---
-//--------------------------------------------------------------------------
-// Perform the 1-Wire Search Algorithm on the 1-Wire bus using the existing
-// search state.
-// Return TRUE  : device found, ROM number in ROM_NO buffer
-//        FALSE : device not found, end of search
-//
-uint8_t search(uint8_t *newAddr) {
-	uint8_t id_bit_number;
-	uint8_t last_zero, rom_byte_number, search_result;
-	uint8_t id_bit, cmp_id_bit;
-	uint8_t ii = 0;
-	unsigned char ROM_NO[8];
-	unsigned char rom_byte_mask, search_direction;
-
-	// initialize for search
-	id_bit_number = 1;
-	last_zero = 0;
-	rom_byte_number = 0;
-	rom_byte_mask = 1;
-	search_result = 0;
-
-	// if the last call was not the last one
-	if (!LastDeviceFlag) {
-		// 1-Wire reset
-		ii = reset();
-		if (ii) // ii>0
-		{
-			// reset the search
-			LastDiscrepancy = 0;
-			LastDeviceFlag = FALSE;
-			LastFamilyDiscrepancy = 0;
-			return ii;	// Pass back the reset error status  gf***
-		}
-		// issue the search command
-
-		write_byte(DS1820_SEARCHROM);
-
-		// loop to do the search
-		do {
-			// read a bit and its complement
-			id_bit = read_bit();
-			cmp_id_bit = read_bit();
-
-			// check for no devices on 1-wire
-			if ((id_bit == 1) && (cmp_id_bit == 1))
-				break;
-			else {
-				// all devices coupled have 0 or 1
-				if (id_bit != cmp_id_bit)
-					search_direction = id_bit;  // bit write value for search
-				else {
-					// if this discrepancy if before the Last Discrepancy
-					// on a previous next then pick the same as last time
-					if (id_bit_number < LastDiscrepancy)
-						search_direction = ((ROM_NO[rom_byte_number] & rom_byte_mask) > 0);
-					else
-						// if equal to last pick 1, if not then pick 0
-						search_direction = (id_bit_number == LastDiscrepancy);
-
-					// if 0 was picked then record its position in LastZero
-					if (search_direction == 0) {
-						last_zero = id_bit_number;
-
-						// check for Last discrepancy in family
-						if (last_zero < 9)
-							LastFamilyDiscrepancy = last_zero;
-					}
-				}
-
-				// set or clear the bit in the ROM byte rom_byte_number
-				// with mask rom_byte_mask
-				if (search_direction == 1)
-					ROM_NO[rom_byte_number] |= rom_byte_mask;
-				else
-					ROM_NO[rom_byte_number] &= ~rom_byte_mask;
-
-				// serial number search direction write bit
-				write_bit(search_direction);
-
-				// increment the byte counter id_bit_number
-				// and shift the mask rom_byte_mask
-				id_bit_number++;
-				rom_byte_mask <<= 1;
-
-				// if the mask is 0 then go to new SerialNum byte rom_byte_number and reset mask
-				if (rom_byte_mask == 0) {
-					rom_byte_number++;
-					rom_byte_mask = 1;
-				}
-			}
-		} while (rom_byte_number < 8);  // loop until through all ROM bytes 0-7
 
-		// if the search was successful then
-		if (!(id_bit_number < 65)) {
-			// search successful so set LastDiscrepancy,LastDeviceFlag,search_result
-			LastDiscrepancy = last_zero;
+static void ICACHE_FLASH_ATTR sample_done(struct dht_sensor *sensor) {
+	struct dht_sensor_data *result = &sensor->data;
+	uint8_t count = sensor->count;
+	dht_sample_cb cb;
 
-			// check for last device
-			if (LastDiscrepancy == 0)
-				LastDeviceFlag = TRUE;
+	sensor->phase = PHASE_IDLE;
+	result->success = count > 0;
+	result->samples = 0;
+	result->retries = sensor->retries;
 
-			search_result = TRUE;	// All OK status GF***
-		}
+	if (count > 0) {
+		result->samples = DHTCombine(sensor->temperature, sensor->humidity, count,
+				&result->temperature, &result->humidity);
 	}
+	INFO("%s on GPIO%d: %d of %d samples agree, %d failed\r\n", sensor->name, sensor->pin, result->samples, count, sensor->retries);
 
-	// if no device found then reset counters so next 'search' will be like a first
-	//if (search_result || !ROM_NO[0])
-	//if (!ROM_NO[0])
-	if (!search_result || !ROM_NO[0]) {
-		LastDiscrepancy = 0;
-		LastDeviceFlag = FALSE;
-		LastFamilyDiscrepancy = 0;
-		search_result = FALSE;
+	if (--sample_pending > 0) {
+		return;
 	}
-	newAddr[0] = ROM_NO[0];
-	newAddr[1] = ROM_NO[1];
-	newAddr[2] = ROM_NO[2];
-	newAddr[3] = ROM_NO[3];
-	newAddr[4] = ROM_NO[4];
-	newAddr[5] = ROM_NO[5];
-	newAddr[6] = ROM_NO[6];
-	newAddr[7] = ROM_NO[7];
-	return search_result;
+	stats_save();
+
+	// The callback may start the next round
+	cb = sample_cb;
+	sample_cb = NULL;
+	cb(sample_sensors, sample_sensor_count);
 }
 
-static inline float scale_humidity(int *data) {
-	if (sensor_type == DHT11) {
-		return data[0];
+static void ICACHE_FLASH_ATTR sample_step(struct dht_sensor *sensor) {
+	uint32_t wait = 0;
+	uint32_t elapsed;
+	BOOL failed = FALSE;
+
+	if (sensor->phase == PHASE_START) {
+		sensor->last_read = system_get_time();
+		sensor->has_read = TRUE;
+		COUNT(sensor->stats.attempts);
+		if (sensor->driver->start(sensor, &wait)) {
+			sample_arm(sensor, PHASE_POLL, wait);
+			return;
+		}
+		failed = TRUE;
+	} else if (sensor->driver->poll(sensor)) {
+		COUNT(sensor->stats.successes);
+		sensor->temperature[sensor->count] = sensor->reading.temperature;
+		sensor->humidity[sensor->count] = sensor->reading.humidity;
+		sensor->count++;
 	} else {
-		float humidity = data[0] * 256 + data[1];
-		return humidity /= 10;
+		failed = TRUE;
+	}
+	if (failed) {
+		sensor->retries++;
 	}
-}
 
-static inline float scale_temperature(int *data) {
-	if (sensor_type == DHT11) {
-		return data[2];
-	} else {
-		float temperature = data[2] & 0x7f;
-		temperature *= 256;
-		temperature += data[3];
-		temperature /= 10;
-		if (data[2] & 0x80)
-			temperature *= -1;
-		return temperature;
+	elapsed = (system_get_time() - sample_start) / 1000;
+	if (sensor->count >= sample_want || elapsed + sensor->driver->interval > sample_budget) {
+		sample_done(sensor);
+		return;
 	}
+	if (failed) {
+		COUNT(sensor->stats.retries);
+	}
+	sample_arm(sensor, PHASE_START, sensor->driver->interval);
 }
 
-struct dht_sensor_data *ICACHE_FLASH_ATTR readDHT1122(void) {
-	int counter = 0;
-	int laststate = 1;
-	int j = 0;
-	int checksum = 0;
-	int data[100];
-	data[0] = data[1] = data[2] = data[3] = data[4] = 0;
-
-	// Wake up device, 250ms of high
-	GPIO_OUTPUT_SET(DHT_PIN, 1);
-	os_delay_us((uint16_t)(250*1000));
-
-	// Hold low for 20ms
-	GPIO_OUTPUT_SET(DHT_PIN, 0);
-	os_delay_us((uint16_t)(20*1000));
-
-	// High for 40ns
-	GPIO_OUTPUT_SET(DHT_PIN, 1);
-	os_delay_us(40);
-
-	// Set DHT_PIN pin as an input
-	GPIO_DIS_OUTPUT(DHT_PIN);
+/*
+ * Reads all sensors at the same time, each until there are samples good
+ * readings, with the minimum interval of the sensor in between. Failed
+ * reads are retried, as long as the next read starts within budget_ms.
+ * Each sensor gets the median of its good readings in data, then cb is
+ * called. A call while sampling only replaces the callback.
+ */
+void ICACHE_FLASH_ATTR DHTSample(struct dht_sensor *sensors, uint8_t count, uint8_t samples, uint32_t budget_ms, dht_sample_cb cb) {
+	uint8_t i;
 
-	// wait for pin to drop?
-	int i = 0;
-	while (GPIO_INPUT_GET(DHT_PIN) == 1 && i < DHT_MAXCOUNT) {
-		os_delay_us(1);
-		i++;
+	if (sample_cb != NULL) {
+		sample_cb = cb;
+		return;
 	}
-
-	if (i == DHT_MAXCOUNT) {
-		reading.success = 0;
-		INFO("Failed to get reading, dying\r\n");
-		return &reading;
+	if (samples < 1) {
+		samples = 1;
+	} else if (samples > DHT_SAMPLES_MAX) {
+		samples = DHT_SAMPLES_MAX;
 	}
 
-	// read data
-	for (i = 0; i < DHT_MAXTIMINGS; i++) {
-		// Count high time (in approx us)
-		counter = 0;
-		while (GPIO_INPUT_GET(DHT_PIN) == laststate) {
-			counter++;
-			os_delay_us(1);
-			if (counter == 1000)
-				break;
+	sample_cb = cb;
+	sample_sensors = sensors;
+	sample_sensor_count = count;
+	sample_pending = count;
+	sample_want = samples;
+	sample_budget = budget_ms;
+	sample_start = system_get_time();
+	stats_load();
+
+	for (i = 0; i < count; i++) {
+		struct dht_sensor *sensor = &sensors[i];
+		uint32_t wait = 0;
+
+		sensor->count = 0;
+		sensor->retries = 0;
+		if (sensor->driver == NULL) {
+			sample_done(sensor);
+			continue;
 		}
-		laststate = GPIO_INPUT_GET(DHT_PIN);
-		if (counter == 1000)
-			break;
-		// store data after 3 reads
-		if ((i > 3) && (i % 2 == 0)) {
-			// shove each bit into the storage bytes
-			data[j / 8] <<= 1;
-			if (counter > DHT_BREAKTIME)
-				data[j / 8] |= 1;
-			j++;
-		}
-	}
-
-	if (j >= 39) {
-		checksum = (data[0] + data[1] + data[2] + data[3]) & 0xFF;
-		INFO("DHT: %02x %02x %02x %02x [%02x] CS: %02x\r\n", data[0], data[1], data[2], data[3], data[4], checksum);
-		if (data[4] == checksum) {
-			// checksum is valid
-			reading.temperature = scale_temperature(data);
-			reading.humidity = scale_humidity(data);
-			reading.success = 1;
-		} else {
-			INFO("Checksum was incorrect after %d bits. Expected %d but got %d\r\n", j, data[4], checksum);
-			reading.success = 0;
+		if (sensor->has_read) {
+			uint32_t since = (sample_start - sensor->last_read) / 1000;
+			if (since < sensor->driver->interval) {
+				wait = sensor->driver->interval - since;
+			}
 		}
-	} else {
-		INFO("Got too few bits: %d should be at least 40\r\n", j);
-		reading.success = 0;
+		sample_arm(sensor, PHASE_START, wait);
 	}
-	return &reading;
 }
 
-struct dht_sensor_data *ICACHE_FLASH_ATTR DHTRead(void) {
-	if (sensor_type == DS18B20) {
-		DEBUG("Reading DS18B20\r\n");
-		return readDS18B20();
-	} else {
-		DEBUG("Reading DHT 11/22\r\n");
-		return readDHT1122();
+/*
+ * Loads the health counters like DHTSample does, for a wake that sends
+ * readings of an earlier one instead of sampling.
+ */
+void ICACHE_FLASH_ATTR DHTLoadStats(struct dht_sensor *sensors, uint8_t count) {
+	if (sample_cb != NULL) {
+		return;
 	}
+	sample_sensors = sensors;
+	sample_sensor_count = count;
+	stats_load();
 }
 
-void ICACHE_FLASH_ATTR DHTInit(enum DHTType dht_type) {
-	DEBUG("INIT DHT\r\n");
-	sensor_type = dht_type;
-
-	if(dht_type == DHT11) {
-		INFO("DHT setup for type DHT11\r\n");
-	} else if(dht_type == DHT22) {
-		INFO("DHT setup for type DHT22\r\n");
-	} else if(dht_type == DS18B20) {
-		INFO("DHT setup for type DS18B20\r\n");
-	} else {
-		INFO("DHT setup for unknown type\r\n");
-	}
-	PIN_FUNC_SELECT(DHT_MUX, DHT_FUNC);
-
-	if (dht_type != DS18B20) {
-		//DEBUG("Enabled pullup\r\n");
-		PIN_PULLUP_EN(DHT_MUX);
+/*
+ * Binds sensor to a pin. mux and func select the GPIO function of the pin,
+ * like PERIPHS_IO_MUX_GPIO4_U and FUNC_GPIO4 for GPIO 4.
+ */
+void ICACHE_FLASH_ATTR DHTInit(struct dht_sensor *sensor, uint8_t type, const char *name, uint8_t pin, uint32_t mux, uint8_t func) {
+	os_memset(sensor, 0, sizeof(*sensor));
+	sensor->name = name;
+	sensor->type = type;
+	sensor->driver = driver_for(type);
+	sensor->pin = pin;
+	sensor->mux = mux;
+	sensor->func = func;
+
+	if (sensor->driver == NULL) {
+		ERROR("No driver for type %d in this build\r\n", type);
+		return;
 	}
+	INFO("DHT setup for type %s on GPIO%d\r\n", sensor->driver->name, pin);
+	sensor->driver->init(sensor);
 }
-
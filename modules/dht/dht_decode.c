@@ -0,0 +1,171 @@
+#include <c_types.h>
+#include <osapi.h>
+#include "user_config.h"
+#include "dht_decode.h"
+
+#ifdef DRIVER_DHT1122
+/*
+ * Splits the high pulses of the 40 bits into 0 (~26us) and 1 (~70us) at the
+ * widest gap between them, so loop speed, CPU frequency and cache misses do
+ * not matter. If all bits are the same there is no gap, then the 80us
+ * response pulse is the reference. margin is the distance from the
+ * threshold to the closest pulse.
+ */
+uint8_t ICACHE_FLASH_ATTR DHTBitThreshold(const uint8_t *highs, uint8_t response, uint8_t *margin) {
+	uint8_t sorted[40];
+	uint8_t i, j, threshold, gap = 0, closest = 0xFF;
+
+	for (i = 0; i < sizeof(sorted); i++) {
+		uint8_t value = highs[i];
+		for (j = i; j > 0 && sorted[j - 1] > value; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = value;
+	}
+
+	threshold = response * 3 / 5;
+	for (i = 1; i < sizeof(sorted); i++) {
+		if (sorted[i] - sorted[i - 1] > gap) {
+			gap = sorted[i] - sorted[i - 1];
+			if (gap >= DHT_MIN_SPLIT) {
+				threshold = (sorted[i] + sorted[i - 1] + 1) / 2;
+			}
+		}
+	}
+
+	for (i = 0; i < sizeof(sorted); i++) {
+		uint8_t distance = sorted[i] > threshold ? sorted[i] - threshold : threshold - sorted[i];
+		if (distance < closest) {
+			closest = distance;
+		}
+	}
+	*margin = closest;
+	return threshold;
+}
+
+/*
+ * Packs the 40 bits into 5 bytes, MSB first, the last is the checksum
+ */
+void ICACHE_FLASH_ATTR DHTBits(const uint8_t *highs, uint8_t threshold, uint8_t *data) {
+	uint8_t i;
+
+	for (i = 0; i < 5; i++) {
+		data[i] = 0;
+	}
+	for (i = 0; i < 40; i++) {
+		data[i / 8] <<= 1;
+		if (highs[i] > threshold)
+			data[i / 8] |= 1;
+	}
+}
+
+// 1/100 percent
+uint16_t ICACHE_FLASH_ATTR DHTHumidity(const uint8_t *data) {
+#if DHT_TYPE == DHT11
+	return data[0] * 100;
+#else
+	// 1/10 percent
+	return (data[0] * 256 + data[1]) * 10;
+#endif
+}
+
+// 1/100 degree
+int16_t ICACHE_FLASH_ATTR DHTTemperature(const uint8_t *data) {
+#if DHT_TYPE == DHT11
+	return data[2] * 100;
+#else
+	// 1/10 degree, sign and magnitude
+	int16_t temperature = ((data[2] & 0x7f) * 256 + data[3]) * 10;
+	if (data[2] & 0x80)
+		temperature = -temperature;
+	return temperature;
+#endif
+}
+#endif /* DRIVER_DHT1122 */
+
+#ifdef DRIVER_DS18B20
+// 1/16 degree to 1/100 degree, rounded to nearest
+int16_t ICACHE_FLASH_ATTR DHTScaleDS18B20(int16_t raw) {
+	int32_t centi = (int32_t) raw * 25;
+	if (centi >= 0) {
+		return (centi + 2) / 4;
+	}
+	return -((-centi + 2) / 4);
+}
+#endif /* DRIVER_DS18B20 */
+
+static void ICACHE_FLASH_ATTR sort_int16(int16_t *values, uint8_t count) {
+	uint8_t i, j;
+	for (i = 1; i < count; i++) {
+		int16_t value = values[i];
+		for (j = i; j > 0 && values[j - 1] > value; j--) {
+			values[j] = values[j - 1];
+		}
+		values[j] = value;
+	}
+}
+
+static void ICACHE_FLASH_ATTR sort_uint16(uint16_t *values, uint8_t count) {
+	uint8_t i, j;
+	for (i = 1; i < count; i++) {
+		uint16_t value = values[i];
+		for (j = i; j > 0 && values[j - 1] > value; j--) {
+			values[j] = values[j - 1];
+		}
+		values[j] = value;
+	}
+}
+
+/*
+ * Sorts the values and returns their median, the mean of the middle two
+ * for an even count
+ */
+static void ICACHE_FLASH_ATTR median(int16_t *temperature, uint16_t *humidity, uint8_t count,
+		int16_t *result_temperature, uint16_t *result_humidity) {
+	uint8_t mid = count / 2;
+
+	sort_int16(temperature, count);
+	sort_uint16(humidity, count);
+	if (count % 2) {
+		*result_temperature = temperature[mid];
+		*result_humidity = humidity[mid];
+	} else {
+		*result_temperature = ((int32_t) temperature[mid - 1] + temperature[mid]) / 2;
+		*result_humidity = ((uint32_t) humidity[mid - 1] + humidity[mid]) / 2;
+	}
+}
+
+/*
+ * Combines count readings, at most DHT_SAMPLES_MAX, into one. Readings more
+ * than DHT_OUTLIER off the median of all are dropped, the result is the
+ * median of the rest. Returns how many were kept. If none agree, the result
+ * is the median of all and 0 is returned.
+ */
+uint8_t ICACHE_FLASH_ATTR DHTCombine(const int16_t *temperature, const uint16_t *humidity, uint8_t count,
+		int16_t *result_temperature, uint16_t *result_humidity) {
+	int16_t t[DHT_SAMPLES_MAX];
+	uint16_t h[DHT_SAMPLES_MAX];
+	int16_t mt;
+	uint16_t mh;
+	uint8_t i, kept = 0;
+
+	os_memcpy(t, temperature, count * sizeof(t[0]));
+	os_memcpy(h, humidity, count * sizeof(h[0]));
+	median(t, h, count, &mt, &mh);
+	*result_temperature = mt;
+	*result_humidity = mh;
+
+	for (i = 0; i < count; i++) {
+		int32_t dt = (int32_t) temperature[i] - mt;
+		int32_t dh = (int32_t) humidity[i] - mh;
+		if (dt >= -DHT_OUTLIER && dt <= DHT_OUTLIER && dh >= -DHT_OUTLIER && dh <= DHT_OUTLIER) {
+			t[kept] = temperature[i];
+			h[kept] = humidity[i];
+			kept++;
+		}
+	}
+	if (kept > 0) {
+		median(t, h, kept, result_temperature, result_humidity);
+	}
+	return kept;
+}
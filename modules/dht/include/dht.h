@@ -25,22 +25,79 @@
 #include <ets_sys.h>
 #include <osapi.h>
 #include <gpio.h>
+#include "dht_decode.h"
 
-enum DHTType{
-	DHT11,
-	DHT22,
-	DS18B20
-};
-
+/* Fixed point, no soft-float on the lx106 */
 struct dht_sensor_data {
-	float temperature;
-	float humidity;
+	int16_t temperature;	/* 1/100 degree Celsius */
+	uint16_t humidity;		/* 1/100 percent */
 	BOOL success;
+	uint8_t samples;		/* DHTSample: readings that agree with the median */
+	uint8_t retries;		/* DHTSample: failed reads */
+};
+
+#define DHT_HISTOGRAM_BINS	8
+#define DHT_HISTOGRAM_WIDTH	10	/* us per bin */
+#define DHT_STATS_SENSORS	2	/* sensors whose stats survive deep sleep */
+
+/*
+ * Health of a sensor since the last cold boot, counts stop at their maximum
+ */
+struct dht_stats {
+	uint32_t attempts;		/* reads started */
+	uint32_t successes;
+	uint16_t checksum;		/* checksum or CRC mismatch */
+	uint16_t short_reads;	/* no answer or too few bits */
+	uint16_t resets;		/* 1-Wire reset without presence pulse */
+	uint16_t retries;		/* failed reads DHTSample repeated */
+	uint16_t histogram[DHT_HISTOGRAM_BINS];	/* DHT high pulse widths */
+	uint8_t threshold;		/* us, DHT 0/1 split of the last transfer */
+	uint8_t margin;			/* us, closest pulse to the threshold */
 };
 
-#define DHT_MAXTIMINGS	10000
-#define DHT_BREAKTIME	20
-#define DHT_MAXCOUNT	32000
+struct dht_sensor;
+
+/*
+ * A sensor driver. start begins a measurement and tells how long to wait
+ * before poll fetches the result into sensor->reading.
+ */
+struct dht_driver {
+	const char *name;
+	uint32_t interval;	/* ms, minimum time between two reads */
+	void (*init)(struct dht_sensor *sensor);
+	BOOL (*start)(struct dht_sensor *sensor, uint32_t *wait_ms);
+	BOOL (*poll)(struct dht_sensor *sensor);
+};
+
+/*
+ * One sensor on its own pin, set up by DHTInit. data holds the result of
+ * DHTSample.
+ */
+struct dht_sensor {
+	const char *name;
+	uint8_t type;		/* DHT11, DHT22 or DS18B20 */
+	const struct dht_driver *driver;
+	uint8_t pin;		/* GPIO number */
+	uint32_t mux;
+	uint8_t func;
+	struct dht_sensor_data data;
+	struct dht_sensor_data reading;	/* last poll */
+	struct dht_stats stats;
+
+	/* DHTSample state */
+	ETSTimer timer;
+	uint8_t phase;
+	uint8_t count;
+	uint8_t retries;
+	int16_t temperature[DHT_SAMPLES_MAX];
+	uint16_t humidity[DHT_SAMPLES_MAX];
+	uint32_t last_read;
+	BOOL has_read;
+};
+
+typedef void (*dht_sample_cb)(struct dht_sensor *sensors, uint8_t count);
+
+#define DHT_PULSE_TIMEOUT	200	/* us, longest pulse of a transfer */
 
 
 #define DS1820_WRITE_SCRATCHPAD 	0x4E
@@ -55,7 +112,8 @@ struct dht_sensor_data {
 #define DS1820_ALARMSEARCH 			0xEC
 #define DS1820_CONVERT_T            0x44
 
-void DHTInit(enum DHTType dht_type);
-struct dht_sensor_data *DHTRead(void);
+void DHTInit(struct dht_sensor *sensor, uint8_t type, const char *name, uint8_t pin, uint32_t mux, uint8_t func);
+void DHTSample(struct dht_sensor *sensors, uint8_t count, uint8_t samples, uint32_t budget_ms, dht_sample_cb cb);
+void DHTLoadStats(struct dht_sensor *sensors, uint8_t count);
 
 #endif
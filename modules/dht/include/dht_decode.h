@@ -0,0 +1,49 @@
+#ifndef MODULES_INCLUDE_DHT_DECODE_H_
+#define MODULES_INCLUDE_DHT_DECODE_H_
+
+#include <c_types.h>
+#include "user_config.h"
+
+/*
+ * The arithmetic of the sensor drivers, apart from the pin handling so the
+ * host tests in test/ can build it.
+ */
+
+/* Sensor types, macros so the build can pick drivers with #if */
+#define DHT11	0
+#define DHT22	1
+#define DS18B20	2
+
+/*
+ * Only the drivers the configuration uses get built: DHT_TYPE picks one,
+ * DS1820_ENABLE adds the DS18B20.
+ */
+#if DHT_TYPE == DHT11 || DHT_TYPE == DHT22
+#define DRIVER_DHT1122
+#endif
+#if DHT_TYPE == DS18B20 || defined(DS1820_ENABLE)
+#define DRIVER_DS18B20
+#endif
+
+#define DHT_MIN_SPLIT		20	/* us, smallest gap between 0 and 1 highs */
+
+#define DHT_SAMPLES_MAX		9
+
+#ifndef DHT_OUTLIER
+#define DHT_OUTLIER			200	/* 1/100 degree or percent */
+#endif
+
+uint8_t ICACHE_FLASH_ATTR DHTCombine(const int16_t *temperature, const uint16_t *humidity, uint8_t count,
+		int16_t *result_temperature, uint16_t *result_humidity);
+
+#ifdef DRIVER_DHT1122
+uint8_t ICACHE_FLASH_ATTR DHTBitThreshold(const uint8_t *highs, uint8_t response, uint8_t *margin);
+void ICACHE_FLASH_ATTR DHTBits(const uint8_t *highs, uint8_t threshold, uint8_t *data);
+int16_t ICACHE_FLASH_ATTR DHTTemperature(const uint8_t *data);
+uint16_t ICACHE_FLASH_ATTR DHTHumidity(const uint8_t *data);
+#endif
+#ifdef DRIVER_DS18B20
+int16_t ICACHE_FLASH_ATTR DHTScaleDS18B20(int16_t raw);
+#endif
+
+#endif /* MODULES_INCLUDE_DHT_DECODE_H_ */
@@ -0,0 +1,113 @@
+#include <user_interface.h>
+#include <osapi.h>
+#include <c_types.h>
+#include <sntp.h>
+#include "user_config.h"
+#include "rtcmem.h"
+#include "epoch.h"
+
+#ifndef EPOCH_SNTP_SERVER
+#define EPOCH_SNTP_SERVER		"pool.ntp.org"
+#endif
+
+#ifndef EPOCH_SYNC_INTERVAL
+#define EPOCH_SYNC_INTERVAL		86400
+#endif
+
+#ifndef EPOCH_SYNC_TIMEOUT
+#define EPOCH_SYNC_TIMEOUT		5000
+#endif
+
+#define POLL_INTERVAL	100
+
+typedef struct {
+	uint64 offset;		/* Unix time in us at RTC_GetTime 0 */
+	uint32 synced;		/* second, RTC_GetTime of the last sync */
+	uint32 pad;
+} epoch_state_t;
+
+static epoch_state_t state;
+static BOOL loaded = FALSE;
+static BOOL syncing = FALSE;
+static uint32 started;
+static ETSTimer poll_timer;
+
+static void ICACHE_FLASH_ATTR load(void) {
+	if (!loaded) {
+		loaded = TRUE;
+		if (!RTC_Load(RTC_SLOT_EPOCH, &state, sizeof(state))) {
+			os_memset(&state, 0, sizeof(state));
+		} else if (system_get_rst_info()->reason != REASON_DEEP_SLEEP_AWAKE) {
+			// RTC_GetTime does not count the time the counter was
+			// restarting, the offset is off by that gap
+			os_memset(&state, 0, sizeof(state));
+			RTC_Clear(RTC_SLOT_EPOCH);
+		}
+	}
+}
+
+static void ICACHE_FLASH_ATTR poll(void *arg) {
+	uint32 now = sntp_get_current_timestamp();
+	uint64 rtc = RTC_GetTime();
+
+	if (now != 0) {
+		state.offset = (uint64) now * 1000000 - rtc;
+		state.synced = rtc / 1000000;
+		RTC_Save(RTC_SLOT_EPOCH, &state, sizeof(state));
+		INFO("Epoch: synced, %d\r\n", now);
+	} else if (system_get_time() - started < EPOCH_SYNC_TIMEOUT * 1000) {
+		os_timer_arm(&poll_timer, POLL_INTERVAL, 0);
+		return;
+	} else {
+		WARN("Epoch: no SNTP answer\r\n");
+	}
+	sntp_stop();
+	syncing = FALSE;
+}
+
+/*
+ * Starts SNTP in the background if the offset is unknown or older than
+ * EPOCH_SYNC_INTERVAL. Needs an IP.
+ */
+void ICACHE_FLASH_ATTR EPOCH_Sync(void) {
+	load();
+	if (syncing || (state.offset != 0 && RTC_GetTime() / 1000000 - state.synced < EPOCH_SYNC_INTERVAL)) {
+		return;
+	}
+	DEBUG("Epoch: SNTP with %s\r\n", EPOCH_SNTP_SERVER);
+	syncing = TRUE;
+	started = system_get_time();
+	sntp_setservername(0, EPOCH_SNTP_SERVER);
+	// The SDK defaults to UTC+8
+	sntp_set_timezone(0);
+	sntp_init();
+	os_timer_disarm(&poll_timer);
+	os_timer_setfn(&poll_timer, (os_timer_func_t *) poll, NULL);
+	os_timer_arm(&poll_timer, POLL_INTERVAL, 0);
+}
+
+/*
+ * TRUE while SNTP runs, at most EPOCH_SYNC_TIMEOUT after EPOCH_Sync.
+ */
+BOOL ICACHE_FLASH_ATTR EPOCH_Syncing(void) {
+	return syncing;
+}
+
+/*
+ * FALSE until the first sync after a reset that was not a deep sleep wake.
+ */
+BOOL ICACHE_FLASH_ATTR EPOCH_Valid(void) {
+	load();
+	return state.offset != 0;
+}
+
+/*
+ * Unix time in seconds of rtc_us, a value of RTC_GetTime. 0 if unknown.
+ */
+uint32 ICACHE_FLASH_ATTR EPOCH_At(uint64 rtc_us) {
+	load();
+	if (state.offset == 0) {
+		return 0;
+	}
+	return (state.offset + rtc_us) / 1000000;
+}
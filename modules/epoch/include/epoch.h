@@ -0,0 +1,18 @@
+#ifndef MODULES_INCLUDE_EPOCH_H_
+#define MODULES_INCLUDE_EPOCH_H_
+
+#include <c_types.h>
+
+/*
+ * Wall clock: the offset between RTC_GetTime and the Unix epoch is kept in
+ * RTC memory, so any RTC_GetTime can be turned into a time stamp without
+ * the network. SNTP only runs after a reset that was not a deep sleep
+ * wake, and every EPOCH_SYNC_INTERVAL.
+ */
+
+void ICACHE_FLASH_ATTR EPOCH_Sync(void);
+BOOL ICACHE_FLASH_ATTR EPOCH_Syncing(void);
+BOOL ICACHE_FLASH_ATTR EPOCH_Valid(void);
+uint32 ICACHE_FLASH_ATTR EPOCH_At(uint64 rtc_us);
+
+#endif /* MODULES_INCLUDE_EPOCH_H_ */
@@ -86,6 +86,7 @@ typedef enum {
   MQTT_PUBLISHING,
   MQTT_DELETING,
   MQTT_DELETED,
+  MQTT_DISCONNECT_SENDING,
 } tConnState;
 
 typedef void (*MqttCallback)(uint32_t *args);
@@ -105,10 +106,23 @@ typedef struct  {
   MqttCallback timeoutCb;
   MqttDataCallback dataCb;
   ETSTimer mqttTimer;
+  uint32_t timerTicks;
   uint32_t keepAliveTick;
   uint32_t reconnectTick;
+  uint8_t reconnectAttempts;
+  ETSTimer reconnectTimer;
   uint32_t sendTimeout;
   tConnState connState;
+  uint8_t dnsCached;
+  uint8_t inflight;
+  uint8_t pipelineMode;
+  uint8_t pipelined;
+  uint8_t pipelinedDisconnect;
+  uint8_t* pipeline_buffer;
+  uint16_t pipeline_length;
+  uint8_t flushState;
+  uint32_t sleepTime;
+  ETSTimer flushTimer;
   QUEUE msgQueue;
   void* user_data;
 } MQTT_Client;
@@ -120,6 +134,14 @@ typedef struct  {
 #define MQTT_FLAG_READY     2
 #define MQTT_FLAG_EXIT      4
 
+#define MQTT_PIPELINE_OFF         0
+#define MQTT_PIPELINE_PUBLISH     1
+#define MQTT_PIPELINE_DISCONNECT  2
+
+#define MQTT_FLUSH_NONE     0
+#define MQTT_FLUSH_PENDING  1
+#define MQTT_FLUSH_ASLEEP   2
+
 #define MQTT_EVENT_TYPE_NONE      0
 #define MQTT_EVENT_TYPE_CONNECTED     1
 #define MQTT_EVENT_TYPE_DISCONNECTED  2
@@ -143,6 +165,8 @@ BOOL ICACHE_FLASH_ATTR MQTT_Subscribe(MQTT_Client *client, char* topic, uint8_t
 BOOL ICACHE_FLASH_ATTR MQTT_UnSubscribe(MQTT_Client *client, char* topic);
 void ICACHE_FLASH_ATTR MQTT_Connect(MQTT_Client *mqttClient);
 void ICACHE_FLASH_ATTR MQTT_Disconnect(MQTT_Client *mqttClient);
+void ICACHE_FLASH_ATTR MQTT_SetPipelining(MQTT_Client *mqttClient, uint8_t mode);
+void ICACHE_FLASH_ATTR MQTT_FlushAndSleep(MQTT_Client *mqttClient, uint32_t time_in_us);
 BOOL ICACHE_FLASH_ATTR MQTT_Publish(MQTT_Client *client, const char* topic, const char* data, int data_length, int qos, int retain);
 
 #endif /* USER_AT_MQTT_H_ */
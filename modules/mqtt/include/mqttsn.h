@@ -0,0 +1,62 @@
+/*
+ * mqttsn.h
+ *
+ * MQTT-SN client over UDP. A QoS -1 publish needs no connection to the
+ * gateway and is a single datagram, QoS 0 and 1 connect first.
+ */
+
+#ifndef USER_MQTTSN_H_
+#define USER_MQTTSN_H_
+#include "user_config.h"
+#include "mqttsn_msg.h"
+#include "mqtt.h"
+#include "user_interface.h"
+
+#ifndef MQTTSN_BUF_SIZE
+#define MQTTSN_BUF_SIZE       400
+#endif
+
+typedef enum {
+  MQTTSN_INIT,
+  MQTTSN_CONNECTING,
+  MQTTSN_CONNECTED,
+  MQTTSN_DISCONNECTING,
+  MQTTSN_DISCONNECTED
+} tSnState;
+
+typedef struct {
+  struct espconn *pCon;
+  uint8_t* host;
+  uint32_t port;
+  char* client_id;
+  uint16_t keepalive;
+  uint8_t clean_session;
+  tSnState connState;
+  uint16_t message_id;
+  uint8_t pending_msg_type;
+  uint16_t pending_msg_id;
+  uint8_t sending;
+  uint8_t unacked;
+  uint8_t retries;
+  uint16_t retryTick;
+  uint16_t keepAliveTick;
+  uint8_t out_buffer[MQTTSN_BUF_SIZE];
+  uint16_t out_length;
+  MqttCallback connectedCb;
+  MqttCallback disconnectedCb;
+  MqttCallback publishedCb;
+  MqttCallback timeoutCb;
+  ETSTimer snTimer;
+} MQTTSN_Client;
+
+void ICACHE_FLASH_ATTR MQTTSN_InitConnection(MQTTSN_Client *client, uint8_t* host, uint32_t port);
+BOOL ICACHE_FLASH_ATTR MQTTSN_InitClient(MQTTSN_Client *client, uint8_t* client_id, uint16_t keepAliveTime, uint8_t cleanSession);
+void ICACHE_FLASH_ATTR MQTTSN_OnConnected(MQTTSN_Client *client, MqttCallback connectedCb);
+void ICACHE_FLASH_ATTR MQTTSN_OnDisconnected(MQTTSN_Client *client, MqttCallback disconnectedCb);
+void ICACHE_FLASH_ATTR MQTTSN_OnPublished(MQTTSN_Client *client, MqttCallback publishedCb);
+void ICACHE_FLASH_ATTR MQTTSN_OnTimeout(MQTTSN_Client *client, MqttCallback timeoutCb);
+void ICACHE_FLASH_ATTR MQTTSN_Connect(MQTTSN_Client *client);
+void ICACHE_FLASH_ATTR MQTTSN_Disconnect(MQTTSN_Client *client);
+BOOL ICACHE_FLASH_ATTR MQTTSN_Publish(MQTTSN_Client *client, uint16_t topic_id, const char* data, int data_length, int qos, int retain);
+
+#endif /* USER_MQTTSN_H_ */
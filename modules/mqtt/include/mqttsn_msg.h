@@ -0,0 +1,59 @@
+/*
+ * File:   mqttsn_msg.h
+ *
+ * Packet encoding for MQTT-SN v1.2, limited to what a sensor needs:
+ * connect, publish to pre-defined topic ids, ping and disconnect.
+ */
+
+#ifndef MQTTSN_MSG_H
+#define MQTTSN_MSG_H
+#include "user_config.h"
+#include "c_types.h"
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+enum mqttsn_message_type
+{
+  MQTTSN_MSG_TYPE_CONNECT = 0x04,
+  MQTTSN_MSG_TYPE_CONNACK = 0x05,
+  MQTTSN_MSG_TYPE_PUBLISH = 0x0C,
+  MQTTSN_MSG_TYPE_PUBACK = 0x0D,
+  MQTTSN_MSG_TYPE_PINGREQ = 0x16,
+  MQTTSN_MSG_TYPE_PINGRESP = 0x17,
+  MQTTSN_MSG_TYPE_DISCONNECT = 0x18
+};
+
+enum mqttsn_return_code
+{
+  MQTTSN_ACCEPTED = 0,
+  MQTTSN_REJECTED_CONGESTION,
+  MQTTSN_REJECTED_INVALID_TOPIC_ID,
+  MQTTSN_REJECTED_NOT_SUPPORTED
+};
+
+#define MQTTSN_FLAG_DUP             0x80
+#define MQTTSN_FLAG_RETAIN          0x10
+#define MQTTSN_FLAG_CLEAN_SESSION   0x04
+#define MQTTSN_TOPIC_TYPE_PREDEFINED 0x01
+
+#define MQTTSN_PROTOCOL_ID          0x01
+
+/* QoS -1 publishes without a connection to the gateway */
+#define MQTTSN_QOS_NO_CONNECT       -1
+
+/* Long header, flags, topic id and message id in front of the data */
+#define MQTTSN_PUBLISH_OVERHEAD     9
+
+uint16_t ICACHE_FLASH_ATTR mqttsn_msg_connect(uint8_t* buffer, uint16_t buffer_length, const char* client_id, uint16_t duration, int clean_session);
+uint16_t ICACHE_FLASH_ATTR mqttsn_msg_publish(uint8_t* buffer, uint16_t buffer_length, uint16_t topic_id, uint16_t message_id, const char* data, int data_length, int qos, int retain);
+uint16_t ICACHE_FLASH_ATTR mqttsn_msg_pingreq(uint8_t* buffer, uint16_t buffer_length);
+uint16_t ICACHE_FLASH_ATTR mqttsn_msg_disconnect(uint8_t* buffer, uint16_t buffer_length);
+
+int ICACHE_FLASH_ATTR mqttsn_get_type(const uint8_t* buffer, uint16_t length, uint16_t* offset);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif  /* MQTTSN_MSG_H */
@@ -6,4 +6,5 @@
 uint32_t ICACHE_FLASH_ATTR UTILS_Atoh(const int8_t *s);
 uint8_t ICACHE_FLASH_ATTR UTILS_StrToIP(const int8_t* str, void *ip);
 uint8_t ICACHE_FLASH_ATTR UTILS_IsIPV4 (int8_t *str);
+uint32_t ICACHE_FLASH_ATTR UTILS_Backoff(uint32_t base, uint32_t max, uint8_t attempt);
 #endif
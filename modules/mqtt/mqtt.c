@@ -39,6 +39,9 @@
 #include "user_config.h"
 #include "mqtt.h"
 #include "queue.h"
+#include "rtcmem.h"
+#include "utils.h"
+#include "cpufreq.h"
 
 #define MQTT_TASK_PRIO            2
 #define MQTT_TASK_QUEUE_SIZE      1
@@ -52,6 +55,25 @@
 #define QUEUE_BUFFER_SIZE     2048
 #endif
 
+#ifndef MQTT_RECONNECT_MAX
+#define MQTT_RECONNECT_MAX    300
+#endif
+
+#ifndef MQTT_FLUSH_TIMEOUT
+#define MQTT_FLUSH_TIMEOUT    5000
+#endif
+
+#ifndef MQTT_DNS_TTL
+#define MQTT_DNS_TTL          3600
+#endif
+
+/* Resolved broker address, kept in RTC memory so it survives deep sleep */
+typedef struct {
+  uint32_t host_hash;
+  uint32_t addr;
+  uint32_t expires;
+} mqtt_dns_cache_t;
+
 unsigned char *default_certificate;
 unsigned int default_certificate_len = 0;
 unsigned char *default_private_key;
@@ -63,6 +85,99 @@ os_event_t mqtt_procTaskQueue[MQTT_TASK_QUEUE_SIZE];
 LOCAL uint8_t zero_len_id[2] = { 0, 0 };
 #endif
 
+LOCAL mqtt_dns_cache_t dns_cache;
+LOCAL BOOL dns_cache_loaded = FALSE;
+LOCAL struct espconn dns_refresh_conn;
+LOCAL ip_addr_t dns_refresh_ip;
+
+LOCAL uint32_t ICACHE_FLASH_ATTR
+mqtt_dns_hash(const char *host)
+{
+  // FNV-1a
+  uint32_t hash = 2166136261UL;
+  while (*host) {
+    hash ^= (uint8_t)*host++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+LOCAL uint32_t ICACHE_FLASH_ATTR
+mqtt_dns_now(void)
+{
+  return (uint32_t)(RTC_GetTime() / 1000000);
+}
+
+/**
+  * @brief  Look up the cached address of a broker
+  * @param  host:   Domain of the broker
+  * @param  ip:   Cached address, if any
+  * @param  expired:   Set if the entry has outlived MQTT_DNS_TTL
+  * @retval TRUE if an address was found
+  */
+LOCAL BOOL ICACHE_FLASH_ATTR
+mqtt_dns_cache_get(const char *host, uint32_t *ip, BOOL *expired)
+{
+  if (!dns_cache_loaded) {
+    dns_cache_loaded = TRUE;
+    if (!RTC_Load(RTC_SLOT_DNS, &dns_cache, sizeof(dns_cache)))
+      os_memset(&dns_cache, 0, sizeof(dns_cache));
+  }
+  if (dns_cache.addr == 0 || dns_cache.host_hash != mqtt_dns_hash(host))
+    return FALSE;
+
+  *ip = dns_cache.addr;
+  *expired = (int32_t)(mqtt_dns_now() - dns_cache.expires) >= 0;
+  return TRUE;
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_dns_cache_put(const char *host, uint32_t ip)
+{
+  dns_cache_loaded = TRUE;
+  dns_cache.host_hash = mqtt_dns_hash(host);
+  dns_cache.addr = ip;
+  dns_cache.expires = mqtt_dns_now() + MQTT_DNS_TTL;
+  RTC_Save(RTC_SLOT_DNS, &dns_cache, sizeof(dns_cache));
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_dns_cache_drop(void)
+{
+  os_memset(&dns_cache, 0, sizeof(dns_cache));
+  RTC_Clear(RTC_SLOT_DNS);
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_dns_refreshed(const char *name, ip_addr_t *ipaddr, void *arg)
+{
+  if (ipaddr == NULL || ipaddr->addr == 0) {
+    MQTT_INFO("DNS: Refresh failed, keep cached ip\r\n");
+    return;
+  }
+  MQTT_INFO("DNS: Refreshed ip %d.%d.%d.%d\r\n",
+            *((uint8 *) &ipaddr->addr),
+            *((uint8 *) &ipaddr->addr + 1),
+            *((uint8 *) &ipaddr->addr + 2),
+            *((uint8 *) &ipaddr->addr + 3));
+  mqtt_dns_cache_put(name, ipaddr->addr);
+}
+
+/**
+  * @brief  Resolve the broker in the background, while the connection
+  *         proceeds against the cached address
+  * @param  client:   MQTT_Client reference
+  * @retval None
+  */
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_dns_refresh(MQTT_Client *client)
+{
+  MQTT_INFO("DNS: Cached ip expired, refreshing %s\r\n", client->host);
+  dns_refresh_ip.addr = 0;
+  if (espconn_gethostbyname(&dns_refresh_conn, client->host, &dns_refresh_ip, mqtt_dns_refreshed) == ESPCONN_OK)
+    mqtt_dns_cache_put(client->host, dns_refresh_ip.addr);
+}
+
 LOCAL void ICACHE_FLASH_ATTR
 mqtt_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
 {
@@ -85,10 +200,12 @@ mqtt_dns_found(const char *name, ip_addr_t *ipaddr, void *arg)
 
   if (client->ip.addr == 0 && ipaddr->addr != 0)
   {
+    mqtt_dns_cache_put(client->host, ipaddr->addr);
     os_memcpy(client->pCon->proto.tcp->remote_ip, &ipaddr->addr, 4);
     if (client->security) {
 #ifdef MQTT_SSL_ENABLE
       espconn_secure_set_size(ESPCONN_CLIENT, MQTT_SSL_SIZE);
+      CPUFREQ_Boost(CPUFREQ_TLS);
       espconn_secure_connect(client->pCon);
 #else
       MQTT_INFO("TCP: Do not support SSL\r\n");
@@ -158,6 +275,79 @@ mqtt_send_keepalive(MQTT_Client *client)
   }
 }
 
+/**
+  * @brief  Send DISCONNECT, the socket is closed once it is out
+  * @param  client: MQTT_Client reference
+  * @retval None
+  */
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_send_disconnect(MQTT_Client *client)
+{
+  MQTT_INFO("MQTT: Send disconnect packet to %s:%d\r\n", client->host, client->port);
+  client->mqtt_state.outbound_message = mqtt_msg_disconnect(&client->mqtt_state.mqtt_connection);
+  client->mqtt_state.pending_msg_type = MQTT_MSG_TYPE_DISCONNECT;
+  client->mqtt_state.pending_msg_id = 0;
+  client->sendTimeout = MQTT_SEND_TIMOUT;
+  client->connState = MQTT_DISCONNECT_SENDING;
+  if (client->security) {
+#ifdef MQTT_SSL_ENABLE
+    espconn_secure_send(client->pCon, client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length);
+#else
+    MQTT_INFO("TCP: Do not support SSL\r\n");
+#endif
+  }
+  else {
+    espconn_send(client->pCon, client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length);
+  }
+  client->mqtt_state.outbound_message = NULL;
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_flush_sleep(MQTT_Client *client)
+{
+  os_timer_disarm(&client->flushTimer);
+  os_timer_disarm(&client->mqttTimer);
+  client->timerTicks = 0;
+  client->flushState = MQTT_FLUSH_ASLEEP;
+  MQTT_INFO("MQTT: Deep sleep for %d ms\r\n", client->sleepTime / 1000);
+  system_deep_sleep(client->sleepTime);
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_flush_timeout(void *arg)
+{
+  MQTT_Client* client = (MQTT_Client*)arg;
+  MQTT_INFO("MQTT: Flush deadline reached, %d message(s) unacknowledged\r\n", client->inflight);
+  mqtt_flush_sleep(client);
+}
+
+/**
+  * @brief  Put pipelined messages back into the queue, so they are sent
+  *         the normal way after CONNACK. Pipelining stays off afterwards.
+  * @param  client: MQTT_Client reference
+  * @retval None
+  */
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_pipeline_fallback(MQTT_Client *client)
+{
+  uint16_t offset = 0;
+  uint16_t length;
+
+  MQTT_INFO("MQTT: Pipelining failed, falling back\r\n");
+  client->pipelineMode = MQTT_PIPELINE_OFF;
+  client->pipelined = 0;
+  client->pipelinedDisconnect = 0;
+  while (offset < client->pipeline_length) {
+    length = mqtt_get_total_length(client->pipeline_buffer + offset, client->pipeline_length - offset);
+    if (QUEUE_Puts(&client->msgQueue, client->pipeline_buffer + offset, length) == -1) {
+      MQTT_INFO("MQTT: Queue full\r\n");
+      break;
+    }
+    offset += length;
+  }
+  client->pipeline_length = 0;
+}
+
 /**
   * @brief  Delete tcp client and free all memory
   * @param  mqttClient: The mqtt client which contain TCP client
@@ -266,6 +456,11 @@ mqtt_client_delete(MQTT_Client *mqttClient)
     mqttClient->msgQueue.buf = NULL;
   }
 
+  if (mqttClient->pipeline_buffer != NULL) {
+    os_free(mqttClient->pipeline_buffer);
+    mqttClient->pipeline_buffer = NULL;
+  }
+
   // Initialize state
   mqttClient->connState = WIFI_INIT;
   // Clear callback functions to avoid abnormal callback
@@ -328,8 +523,19 @@ READPACKET:
               case CONNECTION_ACCEPTED:
                 MQTT_INFO("MQTT: Connected to %s:%d\r\n", client->host, client->port);
                 client->connState = MQTT_DATA;
+                client->reconnectAttempts = 0;
+                if (client->pipelinedDisconnect) {
+                  // The broker closes the connection after the pipelined DISCONNECT
+                  client->connState = TCP_DISCONNECTING;
+                }
                 if (client->connectedCb)
                   client->connectedCb((uint32_t*)client);
+                if (client->pipelined) {
+                  client->pipelined = 0;
+                  client->pipeline_length = 0;
+                  if (client->publishedCb)
+                    client->publishedCb((uint32_t*)client);
+                }
                 break;
               case CONNECTION_REFUSE_PROTOCOL:
               case CONNECTION_REFUSE_SERVER_UNAVAILABLE:
@@ -337,6 +543,8 @@ READPACKET:
               case CONNECTION_REFUSE_NOT_AUTHORIZED:
                 MQTT_INFO("MQTT: Connection refuse, reason code: %d\r\n", msg_conn_ret);
               default:
+                if (client->pipelined)
+                  mqtt_pipeline_fallback(client);
                 if (client->security) {
 #ifdef MQTT_SSL_ENABLE
                   espconn_secure_disconnect(client->pCon);
@@ -389,6 +597,8 @@ READPACKET:
             if (client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_PUBLISH && client->mqtt_state.pending_msg_id == msg_id) {
               MQTT_INFO("MQTT: received MQTT_MSG_TYPE_PUBACK, finish QoS1 publish\r\n");
             }
+            if (client->inflight > 0)
+              client->inflight--;
 
             break;
           case MQTT_MSG_TYPE_PUBREC:
@@ -407,6 +617,8 @@ READPACKET:
             if (client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_PUBLISH && client->mqtt_state.pending_msg_id == msg_id) {
               MQTT_INFO("MQTT: receive MQTT_MSG_TYPE_PUBCOMP, finish QoS2 publish\r\n");
             }
+            if (client->inflight > 0)
+              client->inflight--;
             break;
           case MQTT_MSG_TYPE_PINGREQ:
             client->mqtt_state.outbound_message = mqtt_msg_pingresp(&client->mqtt_state.mqtt_connection);
@@ -459,7 +671,10 @@ mqtt_tcpclient_sent_cb(void *arg)
   client->sendTimeout = 0;
   client->keepAliveTick = 0;
 
-  if ((client->connState == MQTT_DATA || client->connState == MQTT_KEEPALIVE_SEND)
+  if (client->connState == MQTT_DISCONNECT_SENDING) {
+    client->connState = TCP_DISCONNECTING;
+  }
+  else if ((client->connState == MQTT_DATA || client->connState == MQTT_KEEPALIVE_SEND)
       && client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_PUBLISH) {
     if (client->publishedCb)
       client->publishedCb((uint32_t*)client);
@@ -467,26 +682,78 @@ mqtt_tcpclient_sent_cb(void *arg)
   system_os_post(MQTT_TASK_PRIO, 0, (os_param_t)client);
 }
 
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_reconnect_timeout(void *arg)
+{
+  MQTT_Client* client = (MQTT_Client*)arg;
+
+  if (client->connState != TCP_RECONNECT_REQ)
+    return;
+  client->connState = TCP_RECONNECT;
+  system_os_post(MQTT_TASK_PRIO, 0, (os_param_t)client);
+  if (client->timeoutCb)
+    client->timeoutCb((uint32_t*)client);
+}
+
+/**
+  * @brief  Arms the client timer to fire every ticks seconds.
+  * @param  client: MQTT_Client reference
+  * @param  ticks: seconds per timer call, 0 to stop it
+  * @retval None
+  */
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_timer_arm(MQTT_Client *client, uint32_t ticks)
+{
+  os_timer_disarm(&client->mqttTimer);
+  client->timerTicks = ticks;
+  if (ticks > 0)
+    os_timer_arm(&client->mqttTimer, ticks * 1000, 1);
+}
+
+/**
+  * @brief  Ticks every second while something is in flight. An idle
+  *         connection only wakes up for the next keepalive, so the CPU
+  *         can sleep in between.
+  * @param  client: MQTT_Client reference
+  * @retval None
+  */
+LOCAL void ICACHE_FLASH_ATTR
+mqtt_timer_schedule(MQTT_Client *client)
+{
+  uint32_t ticks = 1;
+  uint32_t due = client->mqtt_state.connect_info->keepalive / 2 + 1;
+
+  if (client->timerTicks == 0)
+    return;
+  if (client->connState == MQTT_DATA && client->sendTimeout == 0
+      && QUEUE_IsEmpty(&client->msgQueue) && client->keepAliveTick < due)
+    ticks = due - client->keepAliveTick;
+  // Idle stays idle, a re-arm would push the keepalive out
+  if ((ticks > 1) != (client->timerTicks > 1))
+    mqtt_timer_arm(client, ticks);
+}
+
 void ICACHE_FLASH_ATTR mqtt_timer(void *arg)
 {
   MQTT_Client* client = (MQTT_Client*)arg;
 
   if (client->connState == MQTT_DATA) {
-    client->keepAliveTick ++;
+    client->keepAliveTick += client->timerTicks;
     if (client->keepAliveTick > (client->mqtt_state.connect_info->keepalive / 2)) {
       client->connState = MQTT_KEEPALIVE_SEND;
       system_os_post(MQTT_TASK_PRIO, 0, (os_param_t)client);
     }
 
-  } else if (client->connState == TCP_RECONNECT_REQ) {
-    client->reconnectTick ++;
-    if (client->reconnectTick > MQTT_RECONNECT_TIMEOUT) {
-      client->reconnectTick = 0;
-      client->connState = TCP_RECONNECT;
-      system_os_post(MQTT_TASK_PRIO, 0, (os_param_t)client);
-      if (client->timeoutCb)
-        client->timeoutCb((uint32_t*)client);
-    }
+  } else if (client->connState == TCP_RECONNECT_REQ && client->reconnectTick == 0) {
+    // Back off exponentially, so a fleet does not hammer a recovering broker
+    uint32_t delay = UTILS_Backoff(MQTT_RECONNECT_TIMEOUT * 1000, MQTT_RECONNECT_MAX * 1000, client->reconnectAttempts);
+    MQTT_INFO("MQTT: Reconnect attempt %d in %d ms\r\n", client->reconnectAttempts + 1, delay);
+    if (client->reconnectAttempts < 255)
+      client->reconnectAttempts ++;
+    client->reconnectTick = 1;
+    os_timer_disarm(&client->reconnectTimer);
+    os_timer_setfn(&client->reconnectTimer, (os_timer_func_t *)mqtt_reconnect_timeout, client);
+    os_timer_arm(&client->reconnectTimer, delay, 0);
   }
   if (client->sendTimeout > 0)
     client->sendTimeout --;
@@ -501,16 +768,27 @@ mqtt_tcpclient_discon_cb(void *arg)
   MQTT_INFO("TCP: Disconnected callback\r\n");
   if (TCP_DISCONNECTING == client->connState) {
     client->connState = TCP_DISCONNECTED;
+    client->pipelinedDisconnect = 0;
   }
   else if (MQTT_DELETING == client->connState) {
     client->connState = MQTT_DELETED;
   }
   else {
+    if (client->pipelined && client->connState == MQTT_CONNECT_SENDING) {
+      // Closed before CONNACK, the broker may not accept pipelined packets
+      mqtt_pipeline_fallback(client);
+    }
     client->connState = TCP_RECONNECT_REQ;
   }
   if (client->disconnectedCb)
     client->disconnectedCb((uint32_t*)client);
 
+  // Unacknowledged messages keep the flush waiting for the reconnect,
+  // until its deadline
+  if (client->flushState == MQTT_FLUSH_PENDING && QUEUE_IsEmpty(&client->msgQueue)
+      && client->inflight == 0)
+    mqtt_flush_sleep(client);
+
   system_os_post(MQTT_TASK_PRIO, 0, (os_param_t)client);
 }
 
@@ -526,29 +804,57 @@ mqtt_tcpclient_connect_cb(void *arg)
 {
   struct espconn *pCon = (struct espconn *)arg;
   MQTT_Client* client = (MQTT_Client *)pCon->reverse;
+  uint8_t *data;
+  uint8_t *end;
+  uint16_t length;
 
   espconn_regist_disconcb(client->pCon, mqtt_tcpclient_discon_cb);
   espconn_regist_recvcb(client->pCon, mqtt_tcpclient_recv);////////
   espconn_regist_sentcb(client->pCon, mqtt_tcpclient_sent_cb);///////
   MQTT_INFO("MQTT: Connected to broker %s:%d\r\n", client->host, client->port);
+  // The handshake is done
+  CPUFREQ_Release(CPUFREQ_TLS);
 
+  client->inflight = 0;
+  client->pipelinedDisconnect = 0;
   mqtt_msg_init(&client->mqtt_state.mqtt_connection, client->mqtt_state.out_buffer, client->mqtt_state.out_buffer_length);
   client->mqtt_state.outbound_message = mqtt_msg_connect(&client->mqtt_state.mqtt_connection, client->mqtt_state.connect_info);
   client->mqtt_state.pending_msg_type = mqtt_get_type(client->mqtt_state.outbound_message->data);
   client->mqtt_state.pending_msg_id = mqtt_get_id(client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length);
 
 
+  length = client->mqtt_state.outbound_message->length;
+  if (client->pipeline_length > 0) {
+    // Send the pipelined publishes in the same segment, right behind CONNECT
+    data = client->mqtt_state.outbound_message->data;
+    end = client->mqtt_state.out_buffer + client->mqtt_state.out_buffer_length;
+    if (data + length + client->pipeline_length + 2 <= end) {
+      os_memcpy(data + length, client->pipeline_buffer, client->pipeline_length);
+      length += client->pipeline_length;
+      // Queued messages only go out after CONNACK, then the flush disconnects
+      if (client->pipelineMode == MQTT_PIPELINE_DISCONNECT && QUEUE_IsEmpty(&client->msgQueue)) {
+        data[length++] = MQTT_MSG_TYPE_DISCONNECT << 4;
+        data[length++] = 0;
+        client->pipelinedDisconnect = 1;
+      }
+      client->pipelined = 1;
+    }
+    else {
+      mqtt_pipeline_fallback(client);
+    }
+  }
+
   client->sendTimeout = MQTT_SEND_TIMOUT;
-  MQTT_INFO("MQTT: Sending, type: %d, id: %04X\r\n", client->mqtt_state.pending_msg_type, client->mqtt_state.pending_msg_id);
+  MQTT_INFO("MQTT: Sending, type: %d, id: %04X, length: %d\r\n", client->mqtt_state.pending_msg_type, client->mqtt_state.pending_msg_id, length);
   if (client->security) {
 #ifdef MQTT_SSL_ENABLE
-    espconn_secure_send(client->pCon, client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length);
+    espconn_secure_send(client->pCon, client->mqtt_state.outbound_message->data, length);
 #else
     MQTT_INFO("TCP: Do not support SSL\r\n");
 #endif
   }
   else {
-    espconn_send(client->pCon, client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length);
+    espconn_send(client->pCon, client->mqtt_state.outbound_message->data, length);
   }
 
   client->mqtt_state.outbound_message = NULL;
@@ -568,8 +874,17 @@ mqtt_tcpclient_recon_cb(void *arg, sint8 errType)
   MQTT_Client* client = (MQTT_Client *)pCon->reverse;
 
   MQTT_INFO("TCP: Reconnect to %s:%d\r\n", client->host, client->port);
-
-  client->connState = TCP_RECONNECT_REQ;
+  CPUFREQ_Release(CPUFREQ_TLS);
+
+  if (client->dnsCached && client->connState == TCP_CONNECTING) {
+    // The cached address may be stale, resolve again right away
+    MQTT_INFO("DNS: Cached ip failed, resolving again\r\n");
+    client->dnsCached = 0;
+    mqtt_dns_cache_drop();
+    client->connState = TCP_RECONNECT;
+  } else {
+    client->connState = TCP_RECONNECT_REQ;
+  }
 
   system_os_post(MQTT_TASK_PRIO, 0, (os_param_t)client);
 
@@ -598,6 +913,22 @@ MQTT_Publish(MQTT_Client *client, const char* topic, const char* data, int data_
     MQTT_INFO("MQTT: Queuing publish failed\r\n");
     return FALSE;
   }
+  if (client->pipelineMode != MQTT_PIPELINE_OFF && qos == 0 &&
+      (client->pCon == NULL || client->connState == TCP_CONNECTING ||
+       client->connState == TCP_RECONNECT_REQ || client->connState == TCP_RECONNECT) &&
+      client->pipeline_length + client->mqtt_state.outbound_message->length <= MQTT_BUF_SIZE) {
+    // Not connected yet, goes out together with CONNECT
+    MQTT_INFO("MQTT: pipelining publish, length: %d\r\n", client->mqtt_state.outbound_message->length);
+    os_memcpy(client->pipeline_buffer + client->pipeline_length,
+              client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length);
+    client->pipeline_length += client->mqtt_state.outbound_message->length;
+    return TRUE;
+  }
+  if (client->pipelinedDisconnect) {
+    // The broker closes the connection, a queued message would be lost
+    MQTT_INFO("MQTT: DISCONNECT already sent, not queuing publish\r\n");
+    return FALSE;
+  }
   MQTT_INFO("MQTT: queuing publish, length: %d, queue size(%d/%d)\r\n", client->mqtt_state.outbound_message->length, client->msgQueue.rb.fill_cnt, client->msgQueue.rb.size);
   while (QUEUE_Puts(&client->msgQueue, client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length) == -1) {
     MQTT_INFO("MQTT: Queue full\r\n");
@@ -736,12 +1067,19 @@ MQTT_Task(os_event_t *e)
       mqtt_send_keepalive(client);
       break;
     case MQTT_DATA:
-      if (QUEUE_IsEmpty(&client->msgQueue) || client->sendTimeout != 0) {
+      if (client->sendTimeout != 0) {
+        break;
+      }
+      if (QUEUE_IsEmpty(&client->msgQueue)) {
+        if (client->flushState == MQTT_FLUSH_PENDING && client->inflight == 0)
+          mqtt_send_disconnect(client);
         break;
       }
       if (QUEUE_Gets(&client->msgQueue, dataBuffer, &dataLen, MQTT_BUF_SIZE) == 0) {
         client->mqtt_state.pending_msg_type = mqtt_get_type(dataBuffer);
         client->mqtt_state.pending_msg_id = mqtt_get_id(dataBuffer, dataLen);
+        if (client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_PUBLISH && mqtt_get_qos(dataBuffer) > 0)
+          client->inflight++;
 
 
         client->sendTimeout = MQTT_SEND_TIMOUT;
@@ -762,6 +1100,7 @@ MQTT_Task(os_event_t *e)
       }
       break;
   }
+  mqtt_timer_schedule(client);
 }
 
 /**
@@ -892,6 +1231,9 @@ MQTT_InitLWT(MQTT_Client *mqttClient, uint8_t* will_topic, uint8_t* will_msg, ui
 void ICACHE_FLASH_ATTR
 MQTT_Connect(MQTT_Client *mqttClient)
 {
+  uint32_t cached_ip;
+  BOOL expired;
+
   if (mqttClient->pCon) {
     // Clean up the old connection forcefully - using MQTT_Disconnect
     // does not actually release the old connection until the
@@ -910,11 +1252,14 @@ MQTT_Connect(MQTT_Client *mqttClient)
 
   mqttClient->keepAliveTick = 0;
   mqttClient->reconnectTick = 0;
+  os_timer_disarm(&mqttClient->reconnectTimer);
 
 
   os_timer_disarm(&mqttClient->mqttTimer);
   os_timer_setfn(&mqttClient->mqttTimer, (os_timer_func_t *)mqtt_timer, mqttClient);
-  os_timer_arm(&mqttClient->mqttTimer, 1000, 1);
+  mqtt_timer_arm(mqttClient, 1);
+
+  mqttClient->dnsCached = 0;
 
   if (UTILS_StrToIP(mqttClient->host, &mqttClient->pCon->proto.tcp->remote_ip)) {
     MQTT_INFO("TCP: Connect to ip  %s:%d\r\n", mqttClient->host, mqttClient->port);
@@ -922,6 +1267,7 @@ MQTT_Connect(MQTT_Client *mqttClient)
     {
 #ifdef MQTT_SSL_ENABLE
       espconn_secure_set_size(ESPCONN_CLIENT, MQTT_SSL_SIZE);
+      CPUFREQ_Boost(CPUFREQ_TLS);
       espconn_secure_connect(mqttClient->pCon);
 #else
       MQTT_INFO("TCP: Do not support SSL\r\n");
@@ -932,6 +1278,27 @@ MQTT_Connect(MQTT_Client *mqttClient)
       espconn_connect(mqttClient->pCon);
     }
   }
+  else if (mqtt_dns_cache_get(mqttClient->host, &cached_ip, &expired)) {
+    MQTT_INFO("TCP: Connect to cached ip of %s:%d\r\n", mqttClient->host, mqttClient->port);
+    os_memcpy(mqttClient->pCon->proto.tcp->remote_ip, &cached_ip, 4);
+    mqttClient->dnsCached = 1;
+    if (mqttClient->security)
+    {
+#ifdef MQTT_SSL_ENABLE
+      espconn_secure_set_size(ESPCONN_CLIENT, MQTT_SSL_SIZE);
+      CPUFREQ_Boost(CPUFREQ_TLS);
+      espconn_secure_connect(mqttClient->pCon);
+#else
+      MQTT_INFO("TCP: Do not support SSL\r\n");
+#endif
+    }
+    else
+    {
+      espconn_connect(mqttClient->pCon);
+    }
+    if (expired)
+      mqtt_dns_refresh(mqttClient);
+  }
   else {
     MQTT_INFO("TCP: Connect to domain %s:%d\r\n", mqttClient->host, mqttClient->port);
     espconn_gethostbyname(mqttClient->pCon, mqttClient->host, &mqttClient->ip, mqtt_dns_found);
@@ -944,7 +1311,64 @@ MQTT_Disconnect(MQTT_Client *mqttClient)
 {
   mqttClient->connState = TCP_DISCONNECTING;
   system_os_post(MQTT_TASK_PRIO, 0, (os_param_t)mqttClient);
-  os_timer_disarm(&mqttClient->mqttTimer);
+  mqtt_timer_arm(mqttClient, 0);
+  os_timer_disarm(&mqttClient->reconnectTimer);
+}
+
+/**
+  * @brief  Send QoS 0 publishes made before the connection is up in the
+  *         same TCP segment as CONNECT, optionally followed by DISCONNECT.
+  *         DISCONNECT is left out if a publish did not fit and was queued.
+  *         CONNACK is checked afterwards, if the broker refuses, the
+  *         messages are sent again the normal way.
+  * @param  client: MQTT_Client reference
+  * @param  mode: MQTT_PIPELINE_OFF, MQTT_PIPELINE_PUBLISH or MQTT_PIPELINE_DISCONNECT,
+  *         stays off if the buffer cannot be allocated
+  * @retval None
+  */
+void ICACHE_FLASH_ATTR
+MQTT_SetPipelining(MQTT_Client *mqttClient, uint8_t mode)
+{
+  if (mode != MQTT_PIPELINE_OFF && mqttClient->pipeline_buffer == NULL) {
+    mqttClient->pipeline_buffer = (uint8_t *)os_zalloc(MQTT_BUF_SIZE);
+    if (mqttClient->pipeline_buffer == NULL) {
+      MQTT_INFO("MQTT: No memory for pipelining, publishing after CONNACK\r\n");
+      mode = MQTT_PIPELINE_OFF;
+    }
+  }
+  mqttClient->pipelineMode = mode;
+}
+
+/**
+  * @brief  Deliver everything, then disconnect and enter deep sleep.
+  *         Waits until the queue is drained and every QoS>0 publish is
+  *         acknowledged, sends DISCONNECT and closes the connection.
+  *         Sleeps regardless once MQTT_FLUSH_TIMEOUT ms have passed.
+  * @param  client: MQTT_Client reference
+  * @param  time_in_us: deep sleep time
+  * @retval None
+  */
+void ICACHE_FLASH_ATTR
+MQTT_FlushAndSleep(MQTT_Client *mqttClient, uint32_t time_in_us)
+{
+  if (mqttClient->flushState != MQTT_FLUSH_NONE)
+    return;
+
+  mqttClient->flushState = MQTT_FLUSH_PENDING;
+  mqttClient->sleepTime = time_in_us;
+
+  // Without a connection there is nothing that could still be delivered
+  if (mqttClient->pCon == NULL ||
+      (mqttClient->connState != MQTT_DATA && mqttClient->connState != MQTT_KEEPALIVE_SEND
+       && QUEUE_IsEmpty(&mqttClient->msgQueue))) {
+    mqtt_flush_sleep(mqttClient);
+    return;
+  }
+
+  os_timer_disarm(&mqttClient->flushTimer);
+  os_timer_setfn(&mqttClient->flushTimer, (os_timer_func_t *)mqtt_flush_timeout, mqttClient);
+  os_timer_arm(&mqttClient->flushTimer, MQTT_FLUSH_TIMEOUT, 0);
+  system_os_post(MQTT_TASK_PRIO, 0, (os_param_t)mqttClient);
 }
 
 void ICACHE_FLASH_ATTR
@@ -961,7 +1385,8 @@ MQTT_DeleteClient(MQTT_Client *mqttClient)
   // }
 
   system_os_post(MQTT_TASK_PRIO, 0, (os_param_t)mqttClient);
-  os_timer_disarm(&mqttClient->mqttTimer);
+  mqtt_timer_arm(mqttClient, 0);
+  os_timer_disarm(&mqttClient->reconnectTimer);
 }
 
 void ICACHE_FLASH_ATTR
@@ -0,0 +1,407 @@
+/* mqttsn.c
+*  Protocol: http://mqtt.org/new/wp-content/uploads/2009/06/MQTT-SN_spec_v1.2.pdf
+*
+*  MQTT-SN client over UDP for sensors that publish to pre-defined topic ids.
+*  QoS -1 publishes are sent without connecting to the gateway. QoS 0 and 1
+*  need a connection, QoS 1 waits for the PUBACK. Only one message waits for
+*  a response at any time, which is all a sensor reporting once per wake needs.
+*/
+
+#include "user_interface.h"
+#include "osapi.h"
+#include "espconn.h"
+#include "os_type.h"
+#include "mem.h"
+#include "debug.h"
+#include "user_config.h"
+#include "mqttsn.h"
+#include "utils.h"
+
+#ifndef MQTTSN_RETRY_TIMEOUT
+#define MQTTSN_RETRY_TIMEOUT  3
+#endif
+
+#ifndef MQTTSN_RETRY_COUNT
+#define MQTTSN_RETRY_COUNT    3
+#endif
+
+/* Packets longer than 255 bytes use a three byte length field */
+#define MQTTSN_TYPE_OFFSET(buf)   ((buf)[0] == 0x01 ? 3 : 1)
+
+LOCAL void ICACHE_FLASH_ATTR mqttsn_close(MQTTSN_Client *client);
+
+/**
+  * @brief  Send a datagram, mqttsn_udp_sent_cb counts it off once it is out
+  * @param  client:   MQTTSN_Client reference
+  * @param  data:     the packet
+  * @param  length:   length of the packet
+  * @retval TRUE if the datagram was handed to the stack
+  */
+LOCAL BOOL ICACHE_FLASH_ATTR
+mqttsn_send(MQTTSN_Client *client, uint8_t *data, uint16_t length)
+{
+  client->keepAliveTick = 0;
+  MQTT_INFO("MQTT-SN: Sending, type: %d, length: %d\r\n", data[MQTTSN_TYPE_OFFSET(data)], length);
+  if (espconn_sendto(client->pCon, data, length) != 0) {
+    MQTT_INFO("MQTT-SN: Send failed\r\n");
+    return FALSE;
+  }
+  client->sending ++;
+  return TRUE;
+}
+
+/**
+  * @brief  Send the message in out_buffer and wait for its response
+  * @param  client:   MQTTSN_Client reference
+  * @param  msg_id:   message id the response has to carry, 0 if none
+  * @retval None
+  */
+LOCAL void ICACHE_FLASH_ATTR
+mqttsn_send_pending(MQTTSN_Client *client, uint16_t msg_id)
+{
+  client->pending_msg_type = client->out_buffer[MQTTSN_TYPE_OFFSET(client->out_buffer)];
+  client->pending_msg_id = msg_id;
+  client->retries = 0;
+  client->retryTick = 0;
+  mqttsn_send(client, client->out_buffer, client->out_length);
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+mqttsn_udp_recv(void *arg, char *pdata, unsigned short len)
+{
+  struct espconn *pCon = (struct espconn *)arg;
+  MQTTSN_Client *client = (MQTTSN_Client *)pCon->reverse;
+  uint8_t *data = (uint8_t *)pdata;
+  uint16_t offset;
+  uint16_t msg_id;
+  int msg_type;
+
+  msg_type = mqttsn_get_type(data, len, &offset);
+  MQTT_INFO("MQTT-SN: data received %d bytes, type: %d\r\n", len, msg_type);
+
+  switch (msg_type) {
+    case MQTTSN_MSG_TYPE_CONNACK:
+      if (client->connState != MQTTSN_CONNECTING || offset + 1 > len)
+        break;
+      client->pending_msg_type = 0;
+      if (data[offset] == MQTTSN_ACCEPTED) {
+        MQTT_INFO("MQTT-SN: Connected to %s:%d\r\n", client->host, client->port);
+        client->connState = MQTTSN_CONNECTED;
+        if (client->connectedCb)
+          client->connectedCb((uint32_t*)client);
+      } else {
+        MQTT_INFO("MQTT-SN: Connection refused, reason code: %d\r\n", data[offset]);
+        mqttsn_close(client);
+      }
+      break;
+    case MQTTSN_MSG_TYPE_PUBACK:
+      if (offset + 5 > len)
+        break;
+      msg_id = (data[offset + 2] << 8) | data[offset + 3];
+      if (client->pending_msg_type != MQTTSN_MSG_TYPE_PUBLISH || client->pending_msg_id != msg_id)
+        break;
+      client->pending_msg_type = 0;
+      if (data[offset + 4] == MQTTSN_ACCEPTED) {
+        MQTT_INFO("MQTT-SN: received PUBACK, finish QoS1 publish\r\n");
+        if (client->publishedCb)
+          client->publishedCb((uint32_t*)client);
+      } else {
+        MQTT_INFO("MQTT-SN: Publish rejected, reason code: %d\r\n", data[offset + 4]);
+        if (client->timeoutCb)
+          client->timeoutCb((uint32_t*)client);
+      }
+      break;
+    case MQTTSN_MSG_TYPE_PINGRESP:
+      if (client->pending_msg_type == MQTTSN_MSG_TYPE_PINGREQ)
+        client->pending_msg_type = 0;
+      break;
+    case MQTTSN_MSG_TYPE_DISCONNECT:
+      // Either the answer to our DISCONNECT or the gateway dropped us
+      client->pending_msg_type = 0;
+      mqttsn_close(client);
+      break;
+    default:
+      break;
+  }
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+mqttsn_udp_sent_cb(void *arg)
+{
+  struct espconn *pCon = (struct espconn *)arg;
+  MQTTSN_Client *client = (MQTTSN_Client *)pCon->reverse;
+
+  if (client->sending > 0)
+    client->sending --;
+  // Nothing acknowledges QoS -1 and QoS 0, sending is all there is. Only
+  // once every datagram is out, as the callback may go to sleep.
+  while (client->sending == 0 && client->unacked > 0) {
+    client->unacked --;
+    if (client->publishedCb)
+      client->publishedCb((uint32_t*)client);
+  }
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+mqttsn_timer(void *arg)
+{
+  MQTTSN_Client *client = (MQTTSN_Client *)arg;
+
+  if (client->pending_msg_type != 0) {
+    client->retryTick ++;
+    if (client->retryTick <= MQTTSN_RETRY_TIMEOUT)
+      return;
+    client->retryTick = 0;
+    if (client->retries < MQTTSN_RETRY_COUNT) {
+      client->retries ++;
+      MQTT_INFO("MQTT-SN: Retry %d, type: %d\r\n", client->retries, client->pending_msg_type);
+      if (client->pending_msg_type == MQTTSN_MSG_TYPE_PUBLISH)
+        client->out_buffer[MQTTSN_TYPE_OFFSET(client->out_buffer) + 1] |= MQTTSN_FLAG_DUP;
+      mqttsn_send(client, client->out_buffer, client->out_length);
+      return;
+    }
+    MQTT_INFO("MQTT-SN: No response from gateway, type: %d\r\n", client->pending_msg_type);
+    client->pending_msg_type = 0;
+    if (client->timeoutCb)
+      client->timeoutCb((uint32_t*)client);
+    mqttsn_close(client);
+  } else if (client->connState == MQTTSN_CONNECTED && client->keepalive > 0) {
+    client->keepAliveTick ++;
+    if (client->keepAliveTick > client->keepalive / 2) {
+      client->out_length = mqttsn_msg_pingreq(client->out_buffer, sizeof(client->out_buffer));
+      mqttsn_send_pending(client, 0);
+    }
+  }
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+mqttsn_closed(void *arg)
+{
+  MQTTSN_Client *client = (MQTTSN_Client *)arg;
+
+  if (client->pCon != NULL) {
+    espconn_delete(client->pCon);
+    if (client->pCon->proto.udp) {
+      os_free(client->pCon->proto.udp);
+      client->pCon->proto.udp = NULL;
+    }
+    os_free(client->pCon);
+    client->pCon = NULL;
+  }
+  client->sending = 0;
+  client->unacked = 0;
+  MQTT_INFO("MQTT-SN: Disconnected\r\n");
+  if (client->disconnectedCb)
+    client->disconnectedCb((uint32_t*)client);
+}
+
+/**
+  * @brief  Release the socket. Deferred, since this is usually called from
+  *         within a callback of that socket.
+  * @param  client:   MQTTSN_Client reference
+  * @retval None
+  */
+LOCAL void ICACHE_FLASH_ATTR
+mqttsn_close(MQTTSN_Client *client)
+{
+  client->connState = MQTTSN_DISCONNECTED;
+  client->pending_msg_type = 0;
+  os_timer_disarm(&client->snTimer);
+  os_timer_setfn(&client->snTimer, (os_timer_func_t *)mqttsn_closed, client);
+  os_timer_arm(&client->snTimer, 1, 0);
+}
+
+LOCAL BOOL ICACHE_FLASH_ATTR
+mqttsn_udp_create(MQTTSN_Client *client)
+{
+  if (client->pCon != NULL)
+    return TRUE;
+
+  client->pCon = (struct espconn *)os_zalloc(sizeof(struct espconn));
+  client->pCon->type = ESPCONN_UDP;
+  client->pCon->state = ESPCONN_NONE;
+  client->pCon->proto.udp = (esp_udp *)os_zalloc(sizeof(esp_udp));
+  if (!UTILS_StrToIP(client->host, &client->pCon->proto.udp->remote_ip)) {
+    MQTT_INFO("MQTT-SN: Gateway has to be an ip, got %s\r\n", client->host);
+    os_free(client->pCon->proto.udp);
+    os_free(client->pCon);
+    client->pCon = NULL;
+    return FALSE;
+  }
+  client->pCon->proto.udp->local_port = espconn_port();
+  client->pCon->proto.udp->remote_port = client->port;
+  client->pCon->reverse = client;
+  espconn_regist_recvcb(client->pCon, mqttsn_udp_recv);
+  espconn_regist_sentcb(client->pCon, mqttsn_udp_sent_cb);
+  espconn_create(client->pCon);
+
+  os_timer_disarm(&client->snTimer);
+  os_timer_setfn(&client->snTimer, (os_timer_func_t *)mqttsn_timer, client);
+  os_timer_arm(&client->snTimer, 1000, 1);
+  return TRUE;
+}
+
+/**
+  * @brief  MQTT-SN publish function.
+  * @param  client:   MQTTSN_Client reference
+  * @param  topic_id:   pre-defined topic id, as configured on the gateway
+  * @param  data:     buffer data send point to
+  * @param  data_length: length of data
+  * @param  qos:    -1, 0 or 1. -1 does not need MQTTSN_Connect
+  * @param  retain:   retain
+  * @retval TRUE if the message was sent
+  */
+BOOL ICACHE_FLASH_ATTR
+MQTTSN_Publish(MQTTSN_Client *client, uint16_t topic_id, const char* data, int data_length, int qos, int retain)
+{
+  uint8_t dataBuffer[MQTTSN_BUF_SIZE];
+  uint16_t dataLen;
+
+  if (qos > 1) {
+    MQTT_INFO("MQTT-SN: QoS %d not supported\r\n", qos);
+    return FALSE;
+  }
+  if (qos >= 0 && client->connState != MQTTSN_CONNECTED) {
+    MQTT_INFO("MQTT-SN: Not connected, QoS %d needs a connection\r\n", qos);
+    return FALSE;
+  }
+  if (!mqttsn_udp_create(client))
+    return FALSE;
+
+  if (qos == 1) {
+    if (client->pending_msg_type != 0) {
+      MQTT_INFO("MQTT-SN: Busy, type %d waits for response\r\n", client->pending_msg_type);
+      return FALSE;
+    }
+    while (++client->message_id == 0);
+    client->out_length = mqttsn_msg_publish(client->out_buffer, sizeof(client->out_buffer),
+                                            topic_id, client->message_id, data, data_length, qos, retain);
+    if (client->out_length == 0) {
+      MQTT_INFO("MQTT-SN: Publish too long\r\n");
+      return FALSE;
+    }
+    mqttsn_send_pending(client, client->message_id);
+    return TRUE;
+  }
+
+  dataLen = mqttsn_msg_publish(dataBuffer, sizeof(dataBuffer), topic_id, 0, data, data_length, qos, retain);
+  if (dataLen == 0) {
+    MQTT_INFO("MQTT-SN: Publish too long\r\n");
+    return FALSE;
+  }
+  if (!mqttsn_send(client, dataBuffer, dataLen))
+    return FALSE;
+  client->unacked ++;
+  return TRUE;
+}
+
+/**
+  * @brief  MQTT-SN initialization connection function
+  * @param  client:   MQTTSN_Client reference
+  * @param  host:   IP string of the gateway
+  * @param  port:   Port of the gateway
+  * @retval None
+  */
+void ICACHE_FLASH_ATTR
+MQTTSN_InitConnection(MQTTSN_Client *client, uint8_t* host, uint32_t port)
+{
+  uint32_t temp;
+  MQTT_INFO("MQTT-SN:InitConnection\r\n");
+  os_memset(client, 0, sizeof(MQTTSN_Client));
+  temp = os_strlen(host);
+  client->host = (uint8_t*)os_zalloc(temp + 1);
+  os_strcpy(client->host, host);
+  client->host[temp] = 0;
+  client->port = port;
+  client->connState = MQTTSN_INIT;
+}
+
+/**
+  * @brief  MQTT-SN initialization client function
+  * @param  client:   MQTTSN_Client reference
+  * @param  client_id:   client id, 1 to 23 characters
+  * @param  keepAliveTime:   keep alive timer, in second
+  * @param  cleanSession:   clean session flag
+  * @retval TRUE if the client id is valid
+  */
+BOOL ICACHE_FLASH_ATTR
+MQTTSN_InitClient(MQTTSN_Client *client, uint8_t* client_id, uint16_t keepAliveTime, uint8_t cleanSession)
+{
+  uint32_t temp;
+  MQTT_INFO("MQTT-SN:InitClient\r\n");
+
+  temp = os_strlen(client_id);
+  if (temp == 0 || temp > 23) {
+    MQTT_INFO("MQTT-SN: Client id has to be 1 to 23 characters\r\n");
+    return FALSE;
+  }
+  client->client_id = (char*)os_zalloc(temp + 1);
+  os_strcpy(client->client_id, client_id);
+  client->keepalive = keepAliveTime;
+  client->clean_session = cleanSession;
+  return TRUE;
+}
+
+/**
+  * @brief  Connect to the gateway, only needed for QoS 0 and 1
+  * @param  client: MQTTSN_Client reference
+  * @retval None
+  */
+void ICACHE_FLASH_ATTR
+MQTTSN_Connect(MQTTSN_Client *client)
+{
+  if (!mqttsn_udp_create(client))
+    return;
+
+  client->out_length = mqttsn_msg_connect(client->out_buffer, sizeof(client->out_buffer),
+                                          client->client_id, client->keepalive, client->clean_session);
+  if (client->out_length == 0) {
+    MQTT_INFO("MQTT-SN: Connect failed, no client id\r\n");
+    return;
+  }
+  MQTT_INFO("MQTT-SN: Connect to %s:%d\r\n", client->host, client->port);
+  client->connState = MQTTSN_CONNECTING;
+  mqttsn_send_pending(client, 0);
+}
+
+/**
+  * @brief  Disconnect from the gateway and release the socket.
+  *         disconnectedCb is called once done.
+  * @param  client: MQTTSN_Client reference
+  * @retval None
+  */
+void ICACHE_FLASH_ATTR
+MQTTSN_Disconnect(MQTTSN_Client *client)
+{
+  if (client->connState == MQTTSN_CONNECTED && client->pCon != NULL) {
+    client->out_length = mqttsn_msg_disconnect(client->out_buffer, sizeof(client->out_buffer));
+    client->connState = MQTTSN_DISCONNECTING;
+    mqttsn_send_pending(client, 0);
+    return;
+  }
+  mqttsn_close(client);
+}
+
+void ICACHE_FLASH_ATTR
+MQTTSN_OnConnected(MQTTSN_Client *client, MqttCallback connectedCb)
+{
+  client->connectedCb = connectedCb;
+}
+
+void ICACHE_FLASH_ATTR
+MQTTSN_OnDisconnected(MQTTSN_Client *client, MqttCallback disconnectedCb)
+{
+  client->disconnectedCb = disconnectedCb;
+}
+
+void ICACHE_FLASH_ATTR
+MQTTSN_OnPublished(MQTTSN_Client *client, MqttCallback publishedCb)
+{
+  client->publishedCb = publishedCb;
+}
+
+void ICACHE_FLASH_ATTR
+MQTTSN_OnTimeout(MQTTSN_Client *client, MqttCallback timeoutCb)
+{
+  client->timeoutCb = timeoutCb;
+}
@@ -0,0 +1,130 @@
+/*
+ * mqttsn_msg.c
+ *
+ * Packet encoding for MQTT-SN v1.2
+ * http://mqtt.org/new/wp-content/uploads/2009/06/MQTT-SN_spec_v1.2.pdf
+ *
+ * Every packet starts with the length, one byte if the packet is shorter
+ * than 256 bytes, else 0x01 followed by two bytes. The message type follows.
+ */
+
+#include <string.h>
+#include "mqttsn_msg.h"
+
+static uint16_t ICACHE_FLASH_ATTR header_length(uint16_t body_length)
+{
+  return (body_length + 2 < 256) ? 2 : 4;
+}
+
+static uint16_t ICACHE_FLASH_ATTR write_header(uint8_t* buffer, uint16_t body_length, uint8_t type)
+{
+  uint16_t length = body_length + header_length(body_length);
+
+  if (length < 256) {
+    buffer[0] = length;
+    buffer[1] = type;
+    return 2;
+  }
+  buffer[0] = 0x01;
+  buffer[1] = length >> 8;
+  buffer[2] = length & 0xff;
+  buffer[3] = type;
+  return 4;
+}
+
+static uint8_t ICACHE_FLASH_ATTR qos_flags(int qos)
+{
+  switch (qos) {
+    case MQTTSN_QOS_NO_CONNECT:
+      return 0x60;
+    case 1:
+      return 0x20;
+    case 2:
+      return 0x40;
+    default:
+      return 0x00;
+  }
+}
+
+uint16_t ICACHE_FLASH_ATTR mqttsn_msg_connect(uint8_t* buffer, uint16_t buffer_length, const char* client_id, uint16_t duration, int clean_session)
+{
+  uint16_t id_length = strlen(client_id);
+  uint16_t body_length = 4 + id_length;
+  uint16_t i;
+
+  if (id_length == 0 || id_length > 23)
+    return 0;
+  if (body_length + header_length(body_length) > buffer_length)
+    return 0;
+
+  i = write_header(buffer, body_length, MQTTSN_MSG_TYPE_CONNECT);
+  buffer[i++] = clean_session ? MQTTSN_FLAG_CLEAN_SESSION : 0;
+  buffer[i++] = MQTTSN_PROTOCOL_ID;
+  buffer[i++] = duration >> 8;
+  buffer[i++] = duration & 0xff;
+  memcpy(buffer + i, client_id, id_length);
+  return i + id_length;
+}
+
+uint16_t ICACHE_FLASH_ATTR mqttsn_msg_publish(uint8_t* buffer, uint16_t buffer_length, uint16_t topic_id, uint16_t message_id, const char* data, int data_length, int qos, int retain)
+{
+  uint16_t body_length = 5 + data_length;
+  uint16_t i;
+
+  if (data_length < 0 || body_length + header_length(body_length) > buffer_length)
+    return 0;
+
+  i = write_header(buffer, body_length, MQTTSN_MSG_TYPE_PUBLISH);
+  buffer[i++] = qos_flags(qos) | (retain ? MQTTSN_FLAG_RETAIN : 0) | MQTTSN_TOPIC_TYPE_PREDEFINED;
+  buffer[i++] = topic_id >> 8;
+  buffer[i++] = topic_id & 0xff;
+  // Only QoS 1 and 2 carry a message id, it has to be 0 otherwise
+  if (qos < 1)
+    message_id = 0;
+  buffer[i++] = message_id >> 8;
+  buffer[i++] = message_id & 0xff;
+  memcpy(buffer + i, data, data_length);
+  return i + data_length;
+}
+
+uint16_t ICACHE_FLASH_ATTR mqttsn_msg_pingreq(uint8_t* buffer, uint16_t buffer_length)
+{
+  if (buffer_length < 2)
+    return 0;
+  return write_header(buffer, 0, MQTTSN_MSG_TYPE_PINGREQ);
+}
+
+uint16_t ICACHE_FLASH_ATTR mqttsn_msg_disconnect(uint8_t* buffer, uint16_t buffer_length)
+{
+  if (buffer_length < 2)
+    return 0;
+  return write_header(buffer, 0, MQTTSN_MSG_TYPE_DISCONNECT);
+}
+
+/**
+  * @brief  Parse the header of a received packet
+  * @param  buffer:   received datagram
+  * @param  length:   length of the datagram
+  * @param  offset:   set to the start of the message body
+  * @retval message type, or -1 if the packet is malformed
+  */
+int ICACHE_FLASH_ATTR mqttsn_get_type(const uint8_t* buffer, uint16_t length, uint16_t* offset)
+{
+  uint16_t total;
+
+  if (length < 2)
+    return -1;
+
+  if (buffer[0] == 0x01) {
+    if (length < 4)
+      return -1;
+    total = (buffer[1] << 8) | buffer[2];
+    *offset = 4;
+  } else {
+    total = buffer[0];
+    *offset = 2;
+  }
+  if (total > length || total < *offset)
+    return -1;
+  return buffer[*offset - 1];
+}
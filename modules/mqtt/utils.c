@@ -35,6 +35,7 @@
 #include <ctype.h>
 #include <math.h>
 #include <stddef.h>
+#include "user_interface.h"
 #include "utils.h"
 
 
@@ -147,3 +148,28 @@ uint32_t ICACHE_FLASH_ATTR UTILS_Atoh(const int8_t *s)
   return value;
 }
 
+
+/**
+ * Exponential backoff with jitter: base doubles with every attempt up to
+ * max, then a delay between half and all of it is picked. The jitter is
+ * derived from the chip id, so devices that lost the connection at the
+ * same moment do not come back in lock-step.
+ */
+uint32_t ICACHE_FLASH_ATTR UTILS_Backoff(uint32_t base, uint32_t max, uint8_t attempt)
+{
+  uint32_t delay = base;
+  uint32_t hash;
+  uint8_t i;
+
+  for (i = 0; i < attempt && delay < max; i++)
+    delay <<= 1;
+  if (delay > max)
+    delay = max;
+
+  hash = system_get_chip_id() ^ ((uint32_t)attempt * 0x9E3779B9UL);
+  hash ^= hash >> 16;
+  hash *= 0x45d9f3bUL;
+  hash ^= hash >> 16;
+
+  return delay / 2 + hash % (delay / 2 + 1);
+}
@@ -0,0 +1,16 @@
+#ifndef MODULES_INCLUDE_CCOUNT_H_
+#define MODULES_INCLUDE_CCOUNT_H_
+
+#include <c_types.h>
+
+/*
+ * CPU cycle counter, system_get_cpu_freq cycles per us. Wraps after 53 s
+ * at 80 MHz.
+ */
+static inline uint32_t OW_CCount(void) {
+	uint32_t cycles;
+	__asm__ __volatile__("rsr %0, ccount" : "=a"(cycles));
+	return cycles;
+}
+
+#endif /* MODULES_INCLUDE_CCOUNT_H_ */
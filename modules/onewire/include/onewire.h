@@ -0,0 +1,31 @@
+#ifndef MODULES_INCLUDE_ONEWIRE_H_
+#define MODULES_INCLUDE_ONEWIRE_H_
+
+#include <c_types.h>
+
+/*
+ * 1-Wire bus master on a GPIO with an external pull-up. Slots are timed
+ * with the CPU cycle counter, with interrupts off during the timed part of
+ * each slot only. pin is the GPIO number, see GPIO_ID_PIN.
+ */
+
+/* Slot timings in microseconds, Maxim AN126 standard speed */
+#define OW_RESET_LOW		480
+#define OW_RESET_SAMPLE		70
+#define OW_RESET_SLOT		960
+#define OW_WRITE_1_LOW		6
+#define OW_WRITE_0_LOW		60
+#define OW_READ_LOW			6
+#define OW_READ_SAMPLE		13	/* AN126 has 15, wait_until only ends after it */
+#define OW_SLOT				70
+
+uint8_t OW_Reset(uint8_t pin);
+void OW_WriteBit(uint8_t pin, uint8_t bit);
+uint8_t OW_ReadBit(uint8_t pin);
+void OW_WriteByte(uint8_t pin, uint8_t byte);
+uint8_t OW_ReadByte(uint8_t pin);
+void OW_Write(uint8_t pin, const uint8_t *data, uint16_t len);
+void OW_Read(uint8_t pin, uint8_t *data, uint16_t len);
+uint8_t ICACHE_FLASH_ATTR OW_Crc8(const uint8_t *data, uint16_t len);
+
+#endif /* MODULES_INCLUDE_ONEWIRE_H_ */
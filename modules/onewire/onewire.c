@@ -0,0 +1,152 @@
+#include <ets_sys.h>
+#include <osapi.h>
+#include <c_types.h>
+#include <user_interface.h>
+#include <gpio.h>
+#include "user_config.h"
+#include "onewire.h"
+#include "ccount.h"
+
+/*
+ * Everything in here runs from IRAM (no ICACHE_FLASH_ATTR), so a cache
+ * miss can not stretch a slot.
+ */
+
+static inline void wait_until(uint32_t start, uint32_t cycles) {
+	while (OW_CCount() - start < cycles);
+}
+
+// The output latch stays low, the pull-up makes the bus high
+static inline void bus_low(uint32_t mask) {
+	GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, mask);
+	GPIO_REG_WRITE(GPIO_ENABLE_W1TS_ADDRESS, mask);
+}
+
+static inline void bus_release(uint32_t mask) {
+	GPIO_REG_WRITE(GPIO_ENABLE_W1TC_ADDRESS, mask);
+}
+
+static inline uint8_t bus_read(uint32_t mask) {
+	return (GPIO_REG_READ(GPIO_IN_ADDRESS) & mask) != 0;
+}
+
+/*
+ * Returns 0 if a device answered with a presence pulse, 1 if there is no
+ * device and 2 if the bus stays low.
+ */
+uint8_t OW_Reset(uint8_t pin) {
+	uint32_t mhz = system_get_cpu_freq();
+	uint32_t mask = 1 << pin;
+	uint32_t start;
+	uint8_t present;
+
+	start = OW_CCount();
+	bus_low(mask);
+	wait_until(start, OW_RESET_LOW * mhz);
+
+	ETS_INTR_LOCK();
+	start = OW_CCount();
+	bus_release(mask);
+	wait_until(start, OW_RESET_SAMPLE * mhz);
+	present = !bus_read(mask);
+	ETS_INTR_UNLOCK();
+
+	wait_until(start, (OW_RESET_SLOT - OW_RESET_LOW) * mhz);
+	if (!present) {
+		return 1;
+	}
+	// The device should have stopped pulling the bus now
+	if (!bus_read(mask)) {
+		return 2;
+	}
+	return 0;
+}
+
+void OW_WriteBit(uint8_t pin, uint8_t bit) {
+	uint32_t mhz = system_get_cpu_freq();
+	uint32_t mask = 1 << pin;
+	uint32_t start;
+
+	ETS_INTR_LOCK();
+	start = OW_CCount();
+	bus_low(mask);
+	wait_until(start, (bit ? OW_WRITE_1_LOW : OW_WRITE_0_LOW) * mhz);
+	bus_release(mask);
+	ETS_INTR_UNLOCK();
+
+	// Recovery, a longer one does not hurt
+	wait_until(start, OW_SLOT * mhz);
+}
+
+uint8_t OW_ReadBit(uint8_t pin) {
+	uint32_t mhz = system_get_cpu_freq();
+	uint32_t mask = 1 << pin;
+	uint32_t start;
+	uint8_t bit;
+
+	ETS_INTR_LOCK();
+	start = OW_CCount();
+	bus_low(mask);
+	wait_until(start, OW_READ_LOW * mhz);
+	bus_release(mask);
+	// The device holds a 0 for at least 15us from the falling edge
+	wait_until(start, OW_READ_SAMPLE * mhz);
+	bit = bus_read(mask);
+	ETS_INTR_UNLOCK();
+
+	wait_until(start, OW_SLOT * mhz);
+	return bit;
+}
+
+// LSB first
+void OW_WriteByte(uint8_t pin, uint8_t byte) {
+	uint8_t i;
+	for (i = 0; i < 8; i++) {
+		OW_WriteBit(pin, byte & 1);
+		byte >>= 1;
+	}
+}
+
+uint8_t OW_ReadByte(uint8_t pin) {
+	uint8_t i;
+	uint8_t byte = 0;
+	for (i = 0; i < 8; i++) {
+		byte >>= 1;
+		if (OW_ReadBit(pin)) {
+			byte |= 0x80;
+		}
+	}
+	return byte;
+}
+
+void OW_Write(uint8_t pin, const uint8_t *data, uint16_t len) {
+	while (len--) {
+		OW_WriteByte(pin, *data++);
+	}
+}
+
+void OW_Read(uint8_t pin, uint8_t *data, uint16_t len) {
+	while (len--) {
+		*data++ = OW_ReadByte(pin);
+	}
+}
+
+/*
+ * Dallas/Maxim CRC-8 (Maxim AN27). The byte table of AN162 is linear, so
+ * two 16 entry tables for the nibbles give the same result in 32 bytes.
+ */
+static const uint8_t crc_low[16] = {
+	0, 94, 188, 226, 97, 63, 221, 131, 194, 156, 126, 32, 163, 253, 31, 65
+};
+static const uint8_t crc_high[16] = {
+	0, 157, 35, 190, 70, 219, 101, 248, 140, 17, 175, 50, 202, 87, 233, 116
+};
+
+uint8_t ICACHE_FLASH_ATTR OW_Crc8(const uint8_t *data, uint16_t len) {
+	uint8_t crc = 0;
+	while (len--) {
+		crc ^= *data++;
+		crc = crc_low[crc & 0x0F] ^ crc_high[crc >> 4];
+	}
+	return crc;
+}
@@ -0,0 +1,29 @@
+#ifndef MODULES_INCLUDE_PAYLOAD_H_
+#define MODULES_INCLUDE_PAYLOAD_H_
+
+#include <c_types.h>
+
+/*
+ * Writes a message into a fixed buffer owned by the caller, no heap and no
+ * os_sprintf. Appends that do not fit are dropped and mark the writer as
+ * overflowed, PAYLOAD_Length then returns -1.
+ */
+typedef struct {
+	char *buf;
+	uint16_t size;
+	uint16_t len;
+	BOOL overflow;
+} PAYLOAD_Writer;
+
+void ICACHE_FLASH_ATTR PAYLOAD_Init(PAYLOAD_Writer *w, char *buf, uint16_t size);
+void ICACHE_FLASH_ATTR PAYLOAD_Raw(PAYLOAD_Writer *w, const char *data, uint16_t len);
+void ICACHE_FLASH_ATTR PAYLOAD_Char(PAYLOAD_Writer *w, char c);
+void ICACHE_FLASH_ATTR PAYLOAD_Uint(PAYLOAD_Writer *w, uint32_t value);
+void ICACHE_FLASH_ATTR PAYLOAD_Int(PAYLOAD_Writer *w, int32_t value);
+void ICACHE_FLASH_ATTR PAYLOAD_Hex(PAYLOAD_Writer *w, uint32_t value, uint8_t digits);
+void ICACHE_FLASH_ATTR PAYLOAD_Centi(PAYLOAD_Writer *w, int32_t value);
+void ICACHE_FLASH_ATTR PAYLOAD_String(PAYLOAD_Writer *w, const char *str);
+void ICACHE_FLASH_ATTR PAYLOAD_Key(PAYLOAD_Writer *w, const char *key);
+int ICACHE_FLASH_ATTR PAYLOAD_Length(PAYLOAD_Writer *w);
+
+#endif /* MODULES_INCLUDE_PAYLOAD_H_ */
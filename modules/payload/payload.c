@@ -0,0 +1,127 @@
+#include <osapi.h>
+#include <c_types.h>
+#include "user_config.h"
+#include "payload.h"
+
+/*
+ * Starts an empty message in buf. One byte of buf is kept for the
+ * terminating zero, so the message can be logged as a string.
+ */
+void ICACHE_FLASH_ATTR PAYLOAD_Init(PAYLOAD_Writer *w, char *buf, uint16_t size) {
+	w->buf = buf;
+	w->size = size;
+	w->len = 0;
+	w->overflow = (size == 0);
+	if (size > 0) {
+		buf[0] = '\0';
+	}
+}
+
+void ICACHE_FLASH_ATTR PAYLOAD_Raw(PAYLOAD_Writer *w, const char *data, uint16_t len) {
+	if (w->overflow || w->len + len >= w->size) {
+		w->overflow = TRUE;
+		return;
+	}
+	os_memcpy(w->buf + w->len, data, len);
+	w->len += len;
+	w->buf[w->len] = '\0';
+}
+
+void ICACHE_FLASH_ATTR PAYLOAD_Char(PAYLOAD_Writer *w, char c) {
+	PAYLOAD_Raw(w, &c, 1);
+}
+
+void ICACHE_FLASH_ATTR PAYLOAD_Uint(PAYLOAD_Writer *w, uint32_t value) {
+	char digits[10];
+	uint8_t pos = sizeof(digits);
+
+	do {
+		digits[--pos] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	PAYLOAD_Raw(w, digits + pos, sizeof(digits) - pos);
+}
+
+void ICACHE_FLASH_ATTR PAYLOAD_Int(PAYLOAD_Writer *w, int32_t value) {
+	if (value < 0) {
+		PAYLOAD_Char(w, '-');
+		// unsigned, so INT32_MIN does not overflow
+		PAYLOAD_Uint(w, -(uint32_t) value);
+	} else {
+		PAYLOAD_Uint(w, value);
+	}
+}
+
+/*
+ * Writes value as upper case hex, zero padded to digits (at most 8).
+ */
+void ICACHE_FLASH_ATTR PAYLOAD_Hex(PAYLOAD_Writer *w, uint32_t value, uint8_t digits) {
+	char hex[8];
+	uint8_t pos = sizeof(hex);
+
+	do {
+		hex[--pos] = "0123456789ABCDEF"[value & 0xF];
+		value >>= 4;
+	} while ((value || sizeof(hex) - pos < digits) && pos > 0);
+
+	PAYLOAD_Raw(w, hex + pos, sizeof(hex) - pos);
+}
+
+/*
+ * Writes a value in 1/100 with two fraction digits, 2005 -> "20.05"
+ */
+void ICACHE_FLASH_ATTR PAYLOAD_Centi(PAYLOAD_Writer *w, int32_t value) {
+	uint32_t magnitude = value < 0 ? -(uint32_t) value : (uint32_t) value;
+	uint8_t fraction = magnitude % 100;
+
+	if (value < 0) {
+		PAYLOAD_Char(w, '-');
+	}
+	PAYLOAD_Int(w, magnitude / 100);
+	PAYLOAD_Char(w, '.');
+	PAYLOAD_Char(w, '0' + fraction / 10);
+	PAYLOAD_Char(w, '0' + fraction % 10);
+}
+
+/*
+ * Writes str as a quoted JSON string. Quotes and backslashes are escaped,
+ * control characters are dropped.
+ */
+void ICACHE_FLASH_ATTR PAYLOAD_String(PAYLOAD_Writer *w, const char *str) {
+	const char *run;
+
+	PAYLOAD_Char(w, '"');
+	while (*str) {
+		// Plain characters go in one piece
+		for (run = str; *str && *str != '"' && *str != '\\' && (uint8_t) *str >= 0x20; str++);
+		if (str > run) {
+			PAYLOAD_Raw(w, run, str - run);
+		}
+		if (*str == '"' || *str == '\\') {
+			PAYLOAD_Char(w, '\\');
+			PAYLOAD_Char(w, *str++);
+		} else if (*str) {
+			str++;
+		}
+	}
+	PAYLOAD_Char(w, '"');
+}
+
+/*
+ * Writes a JSON object key, with the separating comma unless it is the
+ * first member of the object.
+ */
+void ICACHE_FLASH_ATTR PAYLOAD_Key(PAYLOAD_Writer *w, const char *key) {
+	if (w->len > 0 && w->buf[w->len - 1] != '{' && w->buf[w->len - 1] != '[') {
+		PAYLOAD_Char(w, ',');
+	}
+	PAYLOAD_String(w, key);
+	PAYLOAD_Char(w, ':');
+}
+
+/*
+ * Returns the length of the message, or -1 if anything did not fit.
+ */
+int ICACHE_FLASH_ATTR PAYLOAD_Length(PAYLOAD_Writer *w) {
+	return w->overflow ? -1 : w->len;
+}
@@ -0,0 +1,31 @@
+#ifndef MODULES_INCLUDE_REPORT_H_
+#define MODULES_INCLUDE_REPORT_H_
+
+#include <c_types.h>
+#include "dht.h"
+
+/*
+ * Reporting policy: a reading is only sent if it moved out of the deadband
+ * around the last sent reading, or if REPORT_HEARTBEAT has passed.
+ * The time between readings follows how fast the first sensor changes,
+ * and gets longer as the supply voltage falls.
+ */
+
+#define REPORT_SENSORS	2	/* sensors the deadband looks at */
+
+void ICACHE_FLASH_ATTR REPORT_Init(void);
+BOOL ICACHE_FLASH_ATTR REPORT_RadioOn(void);
+BOOL ICACHE_FLASH_ATTR REPORT_Due(const struct dht_sensor *sensors, uint8_t count);
+void ICACHE_FLASH_ATTR REPORT_Sent(const struct dht_sensor *sensors, uint8_t count);
+void ICACHE_FLASH_ATTR REPORT_SetSleepOption(uint32 sleep_us);
+void ICACHE_FLASH_ATTR REPORT_WakeRadio(const struct dht_sensor *sensors, uint8_t count, uint64 time, int32_t offset);
+BOOL ICACHE_FLASH_ATTR REPORT_Carried(struct dht_sensor *sensors, uint8_t count, uint64 *time, int32_t *offset);
+void ICACHE_FLASH_ATTR REPORT_Sample(const struct dht_sensor_data *data);
+uint32 ICACHE_FLASH_ATTR REPORT_Interval(void);
+void ICACHE_FLASH_ATTR REPORT_Supply(uint16_t mv);
+uint16_t ICACHE_FLASH_ATTR REPORT_SupplyVoltage(void);
+BOOL ICACHE_FLASH_ATTR REPORT_LastGasp(void);
+BOOL ICACHE_FLASH_ATTR REPORT_DiagDue(void);
+void ICACHE_FLASH_ATTR REPORT_DiagSent(void);
+
+#endif /* MODULES_INCLUDE_REPORT_H_ */
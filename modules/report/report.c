@@ -0,0 +1,374 @@
+#include <user_interface.h>
+#include <osapi.h>
+#include <c_types.h>
+#include "user_config.h"
+#include "rtcmem.h"
+#include "report.h"
+#include "rfcal.h"
+
+#ifndef REPORT_DEADBAND_TEMPERATURE
+#define REPORT_DEADBAND_TEMPERATURE	0
+#endif
+
+#ifndef REPORT_DEADBAND_HUMIDITY
+#define REPORT_DEADBAND_HUMIDITY	0
+#endif
+
+#ifndef REPORT_HEARTBEAT
+#define REPORT_HEARTBEAT	3600
+#endif
+
+#ifndef REPORT_INTERVAL_MIN
+#define REPORT_INTERVAL_MIN	60
+#endif
+
+#ifndef REPORT_INTERVAL_MAX
+#define REPORT_INTERVAL_MAX	3600
+#endif
+
+#ifndef REPORT_DIAG_INTERVAL
+#define REPORT_DIAG_INTERVAL	21600
+#endif
+
+#ifndef REPORT_VDD_LOW
+#define REPORT_VDD_LOW		3000
+#endif
+
+#ifndef REPORT_VDD_CRITICAL
+#define REPORT_VDD_CRITICAL	2800
+#endif
+
+#ifndef REPORT_VDD_BROWNOUT
+#define REPORT_VDD_BROWNOUT	2600
+#endif
+
+#define HEARTBEAT_US	((uint64) REPORT_HEARTBEAT * 1000000)
+
+/* Longest interval, system_deep_sleep takes a uint32 of microseconds */
+#define INTERVAL_LIMIT	4294
+
+/* system_get_vdd33 returns garbage if the ADC is not set up for it */
+#define VDD_VALID(mv)	((mv) >= 1800 && (mv) <= 3900)
+
+/* Interval until a slope is known, in seconds */
+#ifdef NO_SLEEP
+#define INTERVAL_FIRST	(REPORT_INTERVAL / 1000)
+#else
+#define INTERVAL_FIRST	(DEEP_SLEEP / 1000000)
+#endif
+
+/* Change the interval is sized for, in 1/100 */
+#if REPORT_DEADBAND_TEMPERATURE > 0
+#define STEP_TEMPERATURE	REPORT_DEADBAND_TEMPERATURE
+#else
+#define STEP_TEMPERATURE	10
+#endif
+#if REPORT_DEADBAND_HUMIDITY > 0
+#define STEP_HUMIDITY		REPORT_DEADBAND_HUMIDITY
+#else
+#define STEP_HUMIDITY		50
+#endif
+
+#define HISTORY_SIZE	4
+
+typedef struct {
+	uint64 reported;		/* RTC_GetTime of the last report */
+	uint64 diagnosed;		/* RTC_GetTime of the last diagnostics */
+	int16_t temperature[REPORT_SENSORS];	/* last reported readings */
+	uint16_t humidity[REPORT_SENSORS];
+	uint8_t valid;			/* bit per sensor, temperature and humidity are set */
+	uint8_t radio;			/* the wake after the sleep has RF enabled */
+	uint16_t supply;		/* mV, last valid measurement, 0 if unknown */
+	uint8_t gasp;			/* the last gasp went out, until the supply recovers */
+	uint8_t pad[3];
+} report_state_t;
+
+/* The last good readings, a ring */
+typedef struct {
+	uint32_t time[HISTORY_SIZE];	/* second, RTC_GetTime */
+	int16_t temperature[HISTORY_SIZE];
+	uint16_t humidity[HISTORY_SIZE];
+	uint8_t count;
+	uint8_t next;
+	uint16_t pad;
+} report_history_t;
+
+/* A reading of a wake without RF, for the wake REPORT_WakeRadio resets into */
+typedef struct {
+	uint64 time;			/* RTC_GetTime of the reading */
+	int32_t offset;			/* ms, WAKE_Offset of the reading */
+	uint32_t pad;
+	struct dht_sensor_data data[REPORT_SENSORS];
+} report_carry_t;
+
+static report_state_t state;
+static report_history_t history;
+static BOOL radio_on = TRUE;
+static BOOL gasp_due = FALSE;
+
+static uint32_t ICACHE_FLASH_ATTR distance(int32_t a, int32_t b) {
+	return a > b ? a - b : b - a;
+}
+
+/*
+ * Loads the last report. The radio is off only if the previous wake
+ * asked for it, any other reset comes up with RF.
+ */
+void ICACHE_FLASH_ATTR REPORT_Init(void) {
+	if (!RTC_Load(RTC_SLOT_REPORT, &state, sizeof(state))) {
+		os_memset(&state, 0, sizeof(state));
+		state.radio = 1;
+	}
+	if (!RTC_Load(RTC_SLOT_HISTORY, &history, sizeof(history))) {
+		os_memset(&history, 0, sizeof(history));
+	}
+#ifndef NO_SLEEP
+	radio_on = state.radio || system_get_rst_info()->reason != REASON_DEEP_SLEEP_AWAKE;
+#endif
+	INFO("Report: radio %s this wake\r\n", radio_on ? "on" : "off");
+}
+
+BOOL ICACHE_FLASH_ATTR REPORT_RadioOn(void) {
+	return radio_on;
+}
+
+/*
+ * Returns TRUE if the readings of the sensors have to be sent, if any of
+ * the first REPORT_SENSORS moved. Failed readings are only sent with the
+ * heartbeat.
+ */
+BOOL ICACHE_FLASH_ATTR REPORT_Due(const struct dht_sensor *sensors, uint8_t count) {
+	uint8_t i;
+
+	if (gasp_due) {
+		return TRUE;
+	}
+	if (RTC_GetTime() - state.reported >= HEARTBEAT_US) {
+		DEBUG("Report: heartbeat\r\n");
+		return TRUE;
+	}
+	if (state.gasp) {
+		// Only the heartbeat until the supply recovers
+		return FALSE;
+	}
+	for (i = 0; i < count && i < REPORT_SENSORS; i++) {
+		const struct dht_sensor_data *data = &sensors[i].data;
+		if (!data->success) {
+			continue;
+		}
+		if (!(state.valid & (1 << i))
+				|| distance(data->temperature, state.temperature[i]) >= REPORT_DEADBAND_TEMPERATURE
+				|| distance(data->humidity, state.humidity[i]) >= REPORT_DEADBAND_HUMIDITY) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * Remembers the readings as the last report, the deadband is around them.
+ */
+void ICACHE_FLASH_ATTR REPORT_Sent(const struct dht_sensor *sensors, uint8_t count) {
+	uint8_t i;
+
+	state.reported = RTC_GetTime();
+	if (gasp_due) {
+		gasp_due = FALSE;
+		state.gasp = 1;
+	}
+	for (i = 0; i < count && i < REPORT_SENSORS; i++) {
+		const struct dht_sensor_data *data = &sensors[i].data;
+		if (data->success) {
+			state.temperature[i] = data->temperature;
+			state.humidity[i] = data->humidity;
+			state.valid |= 1 << i;
+		}
+	}
+	RTC_Save(RTC_SLOT_REPORT, &state, sizeof(state));
+}
+
+/*
+ * Sets the deep sleep option for a sleep of sleep_us. The next wake only
+ * gets RF if the heartbeat is due by then, or if every reading is sent
+ * anyway. A change on a wake without RF costs one extra reset, see
+ * REPORT_WakeRadio.
+ */
+void ICACHE_FLASH_ATTR REPORT_SetSleepOption(uint32 sleep_us) {
+	if (REPORT_DEADBAND_TEMPERATURE == 0 && REPORT_DEADBAND_HUMIDITY == 0) {
+		state.radio = 1;
+	} else {
+		state.radio = RTC_GetTime() + sleep_us - state.reported >= HEARTBEAT_US;
+	}
+	RTC_Save(RTC_SLOT_REPORT, &state, sizeof(state));
+	system_deep_sleep_set_option(RFCAL_Option(state.radio));
+}
+
+/*
+ * Resets right away into a wake with RF, to send a changed reading that
+ * was taken on a wake without. The reading and its time go along, see
+ * REPORT_Carried.
+ */
+void ICACHE_FLASH_ATTR REPORT_WakeRadio(const struct dht_sensor *sensors, uint8_t count, uint64 time, int32_t offset) {
+	report_carry_t carry;
+	uint8_t i;
+
+	os_memset(&carry, 0, sizeof(carry));
+	carry.time = time;
+	carry.offset = offset;
+	for (i = 0; i < count && i < REPORT_SENSORS; i++) {
+		carry.data[i] = sensors[i].data;
+	}
+	RTC_Save(RTC_SLOT_CARRY, &carry, sizeof(carry));
+	state.radio = 1;
+	RTC_Save(RTC_SLOT_REPORT, &state, sizeof(state));
+	system_deep_sleep_set_option(RFCAL_Option(TRUE));
+	system_deep_sleep(1);
+}
+
+/*
+ * Puts the reading REPORT_WakeRadio carried over the reset into the
+ * sensors, once. Returns FALSE if there is none, the sensors have to be
+ * sampled then.
+ */
+BOOL ICACHE_FLASH_ATTR REPORT_Carried(struct dht_sensor *sensors, uint8_t count, uint64 *time, int32_t *offset) {
+	report_carry_t carry;
+	uint8_t i;
+
+	if (!RTC_Load(RTC_SLOT_CARRY, &carry, sizeof(carry))) {
+		return FALSE;
+	}
+	RTC_Clear(RTC_SLOT_CARRY);
+	if (!radio_on || system_get_rst_info()->reason != REASON_DEEP_SLEEP_AWAKE) {
+		// Any other reset may come much later, the reading is stale
+		return FALSE;
+	}
+	for (i = 0; i < count && i < REPORT_SENSORS; i++) {
+		sensors[i].data = carry.data[i];
+	}
+	*time = carry.time;
+	*offset = carry.offset;
+	return TRUE;
+}
+
+/*
+ * Adds a reading to the history the interval is computed from.
+ */
+void ICACHE_FLASH_ATTR REPORT_Sample(const struct dht_sensor_data *data) {
+	if (!data->success) {
+		return;
+	}
+	history.time[history.next] = RTC_GetTime() / 1000000;
+	history.temperature[history.next] = data->temperature;
+	history.humidity[history.next] = data->humidity;
+	history.next = (history.next + 1) % HISTORY_SIZE;
+	if (history.count < HISTORY_SIZE) {
+		history.count++;
+	}
+	RTC_Save(RTC_SLOT_HISTORY, &history, sizeof(history));
+}
+
+/*
+ * Time in seconds for a change of step at the rate of delta per dt.
+ */
+static uint32 ICACHE_FLASH_ATTR interval_for(int32_t delta, uint32 dt, uint32 step) {
+	uint64 interval;
+	if (delta < 0) {
+		delta = -delta;
+	}
+	if (delta == 0) {
+		return REPORT_INTERVAL_MAX;
+	}
+	interval = (uint64) step * dt / delta;
+	return interval > REPORT_INTERVAL_MAX ? REPORT_INTERVAL_MAX : interval;
+}
+
+/*
+ * Returns the time in seconds until the next reading. It is the time the
+ * slope over the history needs to move a reading by the deadband,
+ * bounded by REPORT_INTERVAL_MIN and REPORT_INTERVAL_MAX.
+ */
+uint32 ICACHE_FLASH_ATTR REPORT_Interval(void) {
+	uint8_t newest, oldest;
+	uint32 dt, interval, other;
+
+	if (history.count < 2) {
+		interval = INTERVAL_FIRST;
+	} else {
+		newest = (history.next + HISTORY_SIZE - 1) % HISTORY_SIZE;
+		oldest = (history.next + HISTORY_SIZE - history.count) % HISTORY_SIZE;
+		dt = history.time[newest] - history.time[oldest];
+		interval = interval_for((int32_t) history.temperature[newest] - history.temperature[oldest], dt, STEP_TEMPERATURE);
+		other = interval_for((int32_t) history.humidity[newest] - history.humidity[oldest], dt, STEP_HUMIDITY);
+		if (other < interval) {
+			interval = other;
+		}
+	}
+
+	if (interval < REPORT_INTERVAL_MIN) {
+		interval = REPORT_INTERVAL_MIN;
+	} else if (interval > REPORT_INTERVAL_MAX) {
+		interval = REPORT_INTERVAL_MAX;
+	}
+
+	// A weak supply stretches it, up to INTERVAL_LIMIT
+	if (state.gasp) {
+		return INTERVAL_LIMIT;
+	} else if (state.supply == 0 || state.supply >= REPORT_VDD_LOW) {
+		return interval;
+	} else if (state.supply >= REPORT_VDD_CRITICAL) {
+		interval *= 2;
+	} else {
+		interval *= 4;
+	}
+	return interval > INTERVAL_LIMIT ? INTERVAL_LIMIT : interval;
+}
+
+/*
+ * Takes the supply voltage of this wake in mV. Below REPORT_VDD_BROWNOUT
+ * the next report is the last gasp, after it only the heartbeat goes out
+ * until the supply is back at REPORT_VDD_LOW. system_get_vdd33 needs RF,
+ * so only wakes with RF measure. The heartbeat brings RF at least every
+ * REPORT_HEARTBEAT plus one interval, the value is at most that old.
+ */
+void ICACHE_FLASH_ATTR REPORT_Supply(uint16_t mv) {
+	if (!VDD_VALID(mv)) {
+		DEBUG("Report: no valid supply voltage (%d)\r\n", mv);
+		return;
+	}
+	state.supply = mv;
+	if (mv >= REPORT_VDD_LOW) {
+		state.gasp = 0;
+	} else if (mv < REPORT_VDD_BROWNOUT && !state.gasp) {
+		WARN("Report: supply at %d mV, last gasp\r\n", mv);
+		gasp_due = TRUE;
+	}
+	RTC_Save(RTC_SLOT_REPORT, &state, sizeof(state));
+}
+
+/*
+ * Supply voltage in mV, 0 if it was never measured.
+ */
+uint16_t ICACHE_FLASH_ATTR REPORT_SupplyVoltage(void) {
+	return state.supply;
+}
+
+BOOL ICACHE_FLASH_ATTR REPORT_LastGasp(void) {
+	return gasp_due;
+}
+
+/*
+ * Returns TRUE if the diagnostics are due, every REPORT_DIAG_INTERVAL and
+ * on the first report after a cold boot.
+ */
+BOOL ICACHE_FLASH_ATTR REPORT_DiagDue(void) {
+	return state.diagnosed == 0 || RTC_GetTime() - state.diagnosed >= (uint64) REPORT_DIAG_INTERVAL * 1000000;
+}
+
+void ICACHE_FLASH_ATTR REPORT_DiagSent(void) {
+	state.diagnosed = RTC_GetTime();
+	// RTC_GetTime starts at 0 on a cold boot
+	if (state.diagnosed == 0) {
+		state.diagnosed = 1;
+	}
+	RTC_Save(RTC_SLOT_REPORT, &state, sizeof(state));
+}
@@ -0,0 +1,31 @@
+#ifndef MODULES_INCLUDE_RFCAL_H_
+#define MODULES_INCLUDE_RFCAL_H_
+
+#include <c_types.h>
+
+/*
+ * RF calibration policy: a wake with RF only runs the full calibration
+ * every RFCAL_WAKES wakes with RF, or if the temperature moved by
+ * RFCAL_TEMPERATURE since the last one. The other wakes reuse it.
+ *
+ * The TX power of a wake follows the RSSI of the last association: it
+ * steps down while the link has more than RFCAL_RSSI_MARGIN above
+ * RFCAL_RSSI_TARGET, and back up on a weaker link or a failed association.
+ */
+
+/* RF options of system_phy_set_rfoption and system_deep_sleep_set_option */
+#define RFCAL_OPTION_CAL	1
+#define RFCAL_OPTION_NO_CAL	2
+#define RFCAL_OPTION_OFF	4
+
+uint8_t ICACHE_FLASH_ATTR RFCAL_PreInit(void);
+void ICACHE_FLASH_ATTR RFCAL_Init(void);
+void ICACHE_FLASH_ATTR RFCAL_Temperature(int16_t temperature);
+uint8_t ICACHE_FLASH_ATTR RFCAL_Option(BOOL radio);
+BOOL ICACHE_FLASH_ATTR RFCAL_Calibrated(void);
+uint32 ICACHE_FLASH_ATTR RFCAL_Time(void);
+uint8_t ICACHE_FLASH_ATTR RFCAL_TxPower(void);
+void ICACHE_FLASH_ATTR RFCAL_Rssi(sint8 rssi);
+void ICACHE_FLASH_ATTR RFCAL_LinkFailed(void);
+
+#endif /* MODULES_INCLUDE_RFCAL_H_ */
@@ -0,0 +1,175 @@
+#include <user_interface.h>
+#include <osapi.h>
+#include <c_types.h>
+#include "user_config.h"
+#include "rtcmem.h"
+#include "rfcal.h"
+
+#ifndef RFCAL_WAKES
+#define RFCAL_WAKES		24
+#endif
+
+#ifndef RFCAL_TEMPERATURE
+#define RFCAL_TEMPERATURE	500
+#endif
+
+#ifndef RFCAL_TPW_MIN
+#define RFCAL_TPW_MIN		20
+#endif
+
+#ifndef RFCAL_TPW_MAX
+#define RFCAL_TPW_MAX		82
+#endif
+
+#ifndef RFCAL_TPW_STEP
+#define RFCAL_TPW_STEP		8
+#endif
+
+#ifndef RFCAL_RSSI_TARGET
+#define RFCAL_RSSI_TARGET	-70
+#endif
+
+#ifndef RFCAL_RSSI_MARGIN
+#define RFCAL_RSSI_MARGIN	10
+#endif
+
+typedef struct {
+	uint16_t wakes;			/* wakes with RF since the last calibration */
+	int16_t temperature;	/* 1/100°C at the last calibration */
+	uint8_t option;			/* RF option of the next wake */
+	uint8_t valid;			/* temperature is set */
+	uint8_t tpw;			/* 1/4 dBm, TX power of the next wake */
+	sint8 rssi;				/* dBm, at the last association */
+} rfcal_state_t;
+
+static rfcal_state_t state;
+static uint8_t option;		/* RF option of this wake */
+static uint32 pre_init;		/* system_get_time at the end of user_rf_pre_init */
+static uint32 rf_time;		/* us from user_rf_pre_init to user_init */
+
+/*
+ * Called from user_rf_pre_init, before the RF is set up and before the
+ * UART is, so no logging. Returns the RF option of this wake. Anything
+ * but a deep sleep wake calibrates.
+ */
+uint8_t ICACHE_FLASH_ATTR RFCAL_PreInit(void) {
+	if (!RTC_Load(RTC_SLOT_RFCAL, &state, sizeof(state))) {
+		os_memset(&state, 0, sizeof(state));
+		state.tpw = RFCAL_TPW_MAX;
+	}
+	if (state.tpw < RFCAL_TPW_MIN || state.tpw > RFCAL_TPW_MAX) {
+		state.tpw = RFCAL_TPW_MAX;
+	}
+	if (system_get_rst_info()->reason != REASON_DEEP_SLEEP_AWAKE || state.option == 0) {
+		state.option = RFCAL_OPTION_CAL;
+	}
+	option = state.option;
+	if (option == RFCAL_OPTION_CAL) {
+		state.wakes = 0;
+		state.valid = 0;
+	} else if (option == RFCAL_OPTION_NO_CAL && state.wakes < 0xFFFF) {
+		state.wakes++;
+	}
+	RTC_Save(RTC_SLOT_RFCAL, &state, sizeof(state));
+	pre_init = system_get_time();
+	return option;
+}
+
+/*
+ * Measures how long the RF init took, it runs between user_rf_pre_init
+ * and user_init. Call first thing in user_init.
+ */
+void ICACHE_FLASH_ATTR RFCAL_Init(void) {
+	rf_time = system_get_time() - pre_init;
+	INFO("RF: option %d, %d us, %d wakes since calibration\r\n", option, rf_time, state.wakes);
+}
+
+/*
+ * Tells the policy the temperature of this wake. The first one after a
+ * calibration is the reference for the next.
+ */
+void ICACHE_FLASH_ATTR RFCAL_Temperature(int16_t temperature) {
+	int32_t delta = temperature - state.temperature;
+
+	if (!state.valid) {
+		state.temperature = temperature;
+		state.valid = 1;
+		RTC_Save(RTC_SLOT_RFCAL, &state, sizeof(state));
+	} else if (delta >= RFCAL_TEMPERATURE || delta <= -RFCAL_TEMPERATURE) {
+		DEBUG("RF: temperature moved by %d since calibration\r\n", delta);
+		state.wakes = RFCAL_WAKES;
+	}
+}
+
+/*
+ * Returns the RF option for the next wake and remembers it for
+ * RFCAL_PreInit. radio is FALSE for a wake without RF.
+ */
+uint8_t ICACHE_FLASH_ATTR RFCAL_Option(BOOL radio) {
+	if (!radio) {
+		state.option = RFCAL_OPTION_OFF;
+	} else if (state.wakes >= RFCAL_WAKES) {
+		state.option = RFCAL_OPTION_CAL;
+	} else {
+		state.option = RFCAL_OPTION_NO_CAL;
+	}
+	RTC_Save(RTC_SLOT_RFCAL, &state, sizeof(state));
+	return state.option;
+}
+
+BOOL ICACHE_FLASH_ATTR RFCAL_Calibrated(void) {
+	return option == RFCAL_OPTION_CAL;
+}
+
+/*
+ * Time in us the RF init took this wake.
+ */
+uint32 ICACHE_FLASH_ATTR RFCAL_Time(void) {
+	return rf_time;
+}
+
+/*
+ * TX power for system_phy_set_max_tpw in 1/4 dBm.
+ */
+uint8_t ICACHE_FLASH_ATTR RFCAL_TxPower(void) {
+	return state.tpw;
+}
+
+static void ICACHE_FLASH_ATTR set_tx_power(uint8_t tpw) {
+	if (tpw != state.tpw) {
+		INFO("RF: TX power %d -> %d\r\n", state.tpw, tpw);
+		state.tpw = tpw;
+	}
+	RTC_Save(RTC_SLOT_RFCAL, &state, sizeof(state));
+}
+
+/*
+ * Sizes the TX power of the next wake from the RSSI of this association.
+ * The link is assumed to be about symmetric.
+ */
+void ICACHE_FLASH_ATTR RFCAL_Rssi(sint8 rssi) {
+	uint8_t tpw = state.tpw;
+
+	if (rssi >= 0) {
+		// wifi_station_get_rssi failed
+		return;
+	}
+	state.rssi = rssi;
+	if (rssi > RFCAL_RSSI_TARGET + RFCAL_RSSI_MARGIN) {
+		tpw = tpw > RFCAL_TPW_MIN + RFCAL_TPW_STEP ? tpw - RFCAL_TPW_STEP : RFCAL_TPW_MIN;
+	} else if (rssi < RFCAL_RSSI_TARGET) {
+		tpw = tpw < RFCAL_TPW_MAX - RFCAL_TPW_STEP ? tpw + RFCAL_TPW_STEP : RFCAL_TPW_MAX;
+	}
+	set_tx_power(tpw);
+}
+
+/*
+ * The association failed, goes back to full power right away. The wake
+ * after a success steps down again if the link allows.
+ */
+void ICACHE_FLASH_ATTR RFCAL_LinkFailed(void) {
+	if (state.tpw < RFCAL_TPW_MAX) {
+		set_tx_power(RFCAL_TPW_MAX);
+		system_phy_set_max_tpw(RFCAL_TPW_MAX);
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef MODULES_INCLUDE_RTCMEM_H_
+#define MODULES_INCLUDE_RTCMEM_H_
+
+#include <c_types.h>
+
+/*
+ * Slots in the user area of the RTC memory, which survives deep sleep.
+ * The user area starts at block 64 and has 128 blocks of 4 bytes each.
+ * Every slot starts with a one block header, followed by the data.
+ */
+#define RTC_SLOT_CLOCK		64	/* 5 blocks: cross-sleep clock */
+#define RTC_SLOT_DNS		69	/* 4 blocks: cached broker address */
+#define RTC_SLOT_REPORT		73	/* 9 blocks: last report, radio state */
+#define RTC_SLOT_HISTORY	82	/* 10 blocks: recent readings for the slope */
+#define RTC_SLOT_STATS		92	/* 19 blocks: sensor health counters */
+#define RTC_SLOT_RFCAL		111	/* 3 blocks: RF calibration policy */
+#define RTC_SLOT_LEASE		114	/* 6 blocks: cached DHCP lease */
+#define RTC_SLOT_ARP		120	/* 4 blocks: MAC of the next hop */
+#define RTC_SLOT_WAKE		124	/* 9 blocks: wake schedule */
+#define RTC_SLOT_EPOCH		133	/* 5 blocks: Unix time offset */
+#define RTC_SLOT_CARRY		138	/* 9 blocks: reading for the wake with RF */
+
+#define RTC_SLOT_END		192
+
+BOOL ICACHE_FLASH_ATTR RTC_Load(uint8_t slot, void *data, uint16_t size);
+void ICACHE_FLASH_ATTR RTC_Save(uint8_t slot, const void *data, uint16_t size);
+void ICACHE_FLASH_ATTR RTC_Clear(uint8_t slot);
+uint64 ICACHE_FLASH_ATTR RTC_GetTime(void);
+
+#endif /* MODULES_INCLUDE_RTCMEM_H_ */
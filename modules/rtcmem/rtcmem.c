@@ -0,0 +1,97 @@
+#include <user_interface.h>
+#include <osapi.h>
+#include <c_types.h>
+#include "user_config.h"
+#include "rtcmem.h"
+
+#define RTC_MAGIC	0xA55A
+
+/* Header block: magic, length of the data and a checksum over the data. */
+typedef struct {
+	uint16_t magic;
+	uint8_t size;
+	uint8_t checksum;
+} rtc_header_t;
+
+typedef struct {
+	uint32_t ticks;	/* RTC counter at the last update */
+	uint32_t cali;	/* RTC period at the last update, 12 bits fraction */
+	uint64 us;		/* time since cold boot at the last update */
+} rtc_clock_t;
+
+static rtc_clock_t clock;
+static BOOL clock_loaded = FALSE;
+
+static uint8_t ICACHE_FLASH_ATTR checksum(const uint8_t *data, uint16_t size) {
+	uint8_t sum = 0x5A;
+	while (size--) {
+		sum = (sum << 1 | sum >> 7) ^ *data++;
+	}
+	return sum;
+}
+
+/*
+ * Loads data that was stored with RTC_Save. Returns FALSE after a cold boot,
+ * when the RTC memory holds garbage, or if the layout has changed.
+ * data has to be 4 byte aligned.
+ */
+BOOL ICACHE_FLASH_ATTR RTC_Load(uint8_t slot, void *data, uint16_t size) {
+	rtc_header_t header;
+	if (!system_rtc_mem_read(slot, &header, sizeof(header))) {
+		return FALSE;
+	}
+	if (header.magic != RTC_MAGIC || header.size != size) {
+		return FALSE;
+	}
+	if (!system_rtc_mem_read(slot + 1, data, size)) {
+		return FALSE;
+	}
+	return header.checksum == checksum(data, size);
+}
+
+/*
+ * Stores data in a slot, data has to be 4 byte aligned.
+ */
+void ICACHE_FLASH_ATTR RTC_Save(uint8_t slot, const void *data, uint16_t size) {
+	rtc_header_t header;
+	header.magic = RTC_MAGIC;
+	header.size = size;
+	header.checksum = checksum(data, size);
+	system_rtc_mem_write(slot + 1, data, size);
+	system_rtc_mem_write(slot, &header, sizeof(header));
+}
+
+void ICACHE_FLASH_ATTR RTC_Clear(uint8_t slot) {
+	rtc_header_t header;
+	os_memset(&header, 0, sizeof(header));
+	system_rtc_mem_write(slot, &header, sizeof(header));
+}
+
+/*
+ * Microseconds since the last cold boot. The RTC counter keeps running in
+ * deep sleep, so this is monotonic across wakes. The counter wraps after
+ * some hours, so it has to be called at least once per wake.
+ */
+uint64 ICACHE_FLASH_ATTR RTC_GetTime(void) {
+	uint32_t ticks = system_get_rtc_time();
+	// RTC clock period in us, 12 bits fraction
+	uint32_t cali = system_rtc_clock_cali_proc();
+
+	if (!clock_loaded) {
+		clock_loaded = TRUE;
+		if (!RTC_Load(RTC_SLOT_CLOCK, &clock, sizeof(clock))) {
+			clock.us = 0;
+			clock.ticks = ticks;
+			clock.cali = cali;
+		} else if (system_get_rst_info()->reason != REASON_DEEP_SLEEP_AWAKE) {
+			// counter restarted, keep the time but start counting anew
+			clock.ticks = ticks;
+		}
+	}
+	// The period moves with temperature, over a sleep take the mean
+	clock.us += ((uint64) (uint32_t) (ticks - clock.ticks) * ((clock.cali + cali) / 2)) >> 12;
+	clock.ticks = ticks;
+	clock.cali = cali;
+	RTC_Save(RTC_SLOT_CLOCK, &clock, sizeof(clock));
+	return clock.us;
+}
@@ -0,0 +1,18 @@
+#ifndef MODULES_INCLUDE_WAKE_H_
+#define MODULES_INCLUDE_WAKE_H_
+
+#include <c_types.h>
+
+/*
+ * Wake schedule: every device wakes at its own phase within the interval,
+ * derived from the chip id, so a fleet that was powered up together does
+ * not wake together. From then on each slot is one interval after the
+ * last. The sleep is corrected for the time awake and for how far the
+ * last wake missed its target.
+ */
+
+void ICACHE_FLASH_ATTR WAKE_Init(void);
+uint32 ICACHE_FLASH_ATTR WAKE_SleepTime(uint32 interval);
+int32_t ICACHE_FLASH_ATTR WAKE_Offset(void);
+
+#endif /* MODULES_INCLUDE_WAKE_H_ */
@@ -0,0 +1,128 @@
+#include <user_interface.h>
+#include <osapi.h>
+#include <c_types.h>
+#include "user_config.h"
+#include "rtcmem.h"
+#include "wake.h"
+
+/* Longest sleep, system_deep_sleep takes a uint32 of microseconds */
+#define SLEEP_MAX		4294000000UL
+
+/* Largest correction, in 1/1000000 */
+#define DRIFT_MAX		100000
+
+#ifndef WAKE_MIN_SLEEP
+#define WAKE_MIN_SLEEP	1000
+#endif
+
+typedef struct {
+	uint64 slot;		/* RTC_GetTime this wake was scheduled for, 0 before the first */
+	uint64 target;		/* RTC_GetTime the sleep is meant to end at */
+	uint32 slept;		/* us asked from system_deep_sleep */
+	int32_t drift;		/* 1/1000000, how much too long sleeps turn out */
+	uint8_t pending;	/* target is the end of the current sleep */
+	uint8_t pad[7];
+} wake_state_t;
+
+static wake_state_t state;
+
+/*
+ * Offset of this device within any interval, in ms.
+ */
+static uint32 ICACHE_FLASH_ATTR phase(uint32 interval) {
+	// Knuth's multiplicative hash, chip ids of a batch are close together
+	return (system_get_chip_id() * 2654435761UL) % (interval * 1000);
+}
+
+/*
+ * Compares the time of this wake to the target of the last sleep and
+ * learns the drift. Only deep sleep wakes that were scheduled count, the
+ * target becomes the slot of this wake.
+ */
+void ICACHE_FLASH_ATTR WAKE_Init(void) {
+	int64_t error;
+	int32_t drift;
+
+	if (!RTC_Load(RTC_SLOT_WAKE, &state, sizeof(state))) {
+		os_memset(&state, 0, sizeof(state));
+	}
+	if (system_get_rst_info()->reason == REASON_DEEP_SLEEP_AWAKE && state.pending && state.slept > 0) {
+		// system_get_time counts from the reset, that is when the sleep ended
+		error = (int64_t) (RTC_GetTime() - system_get_time() - state.target);
+		// A missed target by more than a fifth is no drift
+		if (error < (int64_t) state.slept / 5 && error > -(int64_t) state.slept / 5) {
+			// The sleep was already corrected, this is what is left over
+			drift = error * 1000000 / state.slept;
+			state.drift += drift / 4;
+			if (state.drift > DRIFT_MAX) {
+				state.drift = DRIFT_MAX;
+			} else if (state.drift < -DRIFT_MAX) {
+				state.drift = -DRIFT_MAX;
+			}
+			INFO("Wake: %d ms off target, drift %d ppm\r\n", (int32_t) (error / 1000), state.drift);
+		}
+	}
+	// Unscheduled wakes, like REPORT_WakeRadio, stay in the slot
+	if (state.pending) {
+		state.slot = state.target;
+		state.pending = 0;
+	}
+	RTC_Save(RTC_SLOT_WAKE, &state, sizeof(state));
+}
+
+/*
+ * Returns how long to sleep, in us, so the next wake is interval seconds
+ * after the slot of this one. The time awake comes off the sleep, slots
+ * that are already too close are skipped. The first slot is at the phase
+ * of this device in a grid of interval seconds, at least a quarter of the
+ * interval away.
+ */
+uint32 ICACHE_FLASH_ATTR WAKE_SleepTime(uint32 interval) {
+	uint64 now = RTC_GetTime();
+	uint64 period = (uint64) interval * 1000000;
+	uint64 offset = (uint64) phase(interval) * 1000;
+	uint64 target, sleep;
+
+	if (state.slot != 0) {
+		target = state.slot + period;
+		while (target < now + (uint64) WAKE_MIN_SLEEP * 1000) {
+			target += period;
+		}
+	} else {
+		if (now < offset) {
+			target = offset;
+		} else {
+			target = (now - offset) / period * period + offset + period;
+		}
+		if (target - now < period / 4) {
+			target += period;
+		}
+	}
+	while (target - now > SLEEP_MAX) {
+		target -= period;
+	}
+	sleep = target - now;
+	INFO("Wake: awake %d ms, next slot in %d ms\r\n", system_get_time() / 1000, (uint32) (sleep / 1000));
+
+	state.target = target;
+	state.pending = 1;
+	// Sleeps that turned out too long get shorter
+	sleep -= (int64_t) sleep * state.drift / 1000000;
+	if (sleep > SLEEP_MAX) {
+		sleep = SLEEP_MAX;
+	}
+	state.slept = sleep;
+	RTC_Save(RTC_SLOT_WAKE, &state, sizeof(state));
+	return sleep;
+}
+
+/*
+ * Time in ms since the slot of this wake, the reading of a slot is meant
+ * to be taken at the slot. 0 before the first scheduled wake.
+ */
+int32_t ICACHE_FLASH_ATTR WAKE_Offset(void) {
+	if (state.slot == 0) {
+		return 0;
+	}
+	return (int32_t) ((int64_t) (RTC_GetTime() - state.slot) / 1000);
+}
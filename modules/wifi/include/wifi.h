@@ -13,5 +13,8 @@ typedef void (*WifiCallback)(uint8_t);
 
 void ICACHE_FLASH_ATTR WIFI_Connect(uint8_t* ssid, uint8_t* pass, WifiCallback cb);
 void ICACHE_FLASH_ATTR WIFI_Connect_IP(uint8_t* ssid, uint8_t* pass, struct ip_info *ip, WifiCallback cb);
+void ICACHE_FLASH_ATTR WIFI_Connect_Lease(uint8_t* ssid, uint8_t* pass, WifiCallback cb);
+void ICACHE_FLASH_ATTR WIFI_DropLease(void);
+void ICACHE_FLASH_ATTR WIFI_CacheNextHop(const uint8_t *dest);
 
 #endif /* USER_WIFI_H_ */
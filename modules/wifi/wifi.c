@@ -10,38 +10,319 @@
 #include <os_type.h>
 #include <mem.h>
 #include "wifi.h"
+#include "utils.h"
+#include "rtcmem.h"
 #include "user_config.h"
 
+#ifndef WIFI_RETRY_TIMEOUT
+#define WIFI_RETRY_TIMEOUT  2000
+#endif
+
+#ifndef WIFI_RETRY_MAX
+#define WIFI_RETRY_MAX      60000
+#endif
+
+#ifndef WIFI_CHECK_INTERVAL
+#define WIFI_CHECK_INTERVAL 2000
+#endif
+
+#ifndef WIFI_LEASE_TTL
+#define WIFI_LEASE_TTL      3600
+#endif
+
+#ifndef WIFI_ARP_PROBE_TIME
+#define WIFI_ARP_PROBE_TIME 200
+#endif
+
+/* lwIP of the SDK, its headers clash with ip_addr.h */
+struct netif;
+struct eth_addr {
+  uint8_t addr[6];
+};
+struct pbuf;
+struct netif *eagle_lwip_getif(uint8_t index);
+sint8 etharp_request(struct netif *netif, ip_addr_t *ipaddr);
+sint8 etharp_query(struct netif *netif, ip_addr_t *ipaddr, struct pbuf *q);
+sint8 etharp_find_addr(struct netif *netif, ip_addr_t *ipaddr, struct eth_addr **eth_ret, ip_addr_t **ip_ret);
+struct pbuf *pbuf_alloc(int layer, uint16_t length, int type);
+sint8 pbuf_take(struct pbuf *buf, const void *dataptr, uint16_t len);
+uint8_t pbuf_free(struct pbuf *p);
+sint8 ethernet_input(struct pbuf *p, struct netif *netif);
+#define WIFI_PBUF_RAW       3   /* PBUF_RAW of enum pbuf_layer */
+#define WIFI_PBUF_RAM       0   /* PBUF_RAM of enum pbuf_type */
+#define WIFI_ARP_SIZE       42  /* Ethernet header and ARP packet */
+#define WIFI_TIMER_MAX      6870 /* second, longest os_timer_arm */
+
+/* Where the address of the station comes from */
+#define WIFI_LEASE_NONE     0   /* set by WIFI_Connect_IP or plain DHCP */
+#define WIFI_LEASE_CACHED   1   /* cached lease, not checked yet */
+#define WIFI_LEASE_PROBING  2   /* ARP probe for it is out */
+#define WIFI_LEASE_DHCP     3   /* DHCP, the lease gets cached */
+#define WIFI_LEASE_BOUND    4
+
+/* An address DHCP handed out, reused statically until it expires */
+typedef struct {
+  uint32_t ip;
+  uint32_t netmask;
+  uint32_t gw;
+  uint32_t dns;       /* static addresses get no DNS server */
+  uint32_t expires;   /* second, RTC_GetTime */
+} wifi_lease_t;
+
+/* MAC of the next hop to the broker, so the first packet needs no ARP */
+typedef struct {
+  uint32_t ip;
+  uint8_t mac[6];
+  uint16_t pad;
+} wifi_arp_t;
+
 static ETSTimer WiFiLinker;
 WifiCallback wifiCb = NULL;
 static uint8_t wifiStatus = STATION_IDLE, lastWifiStatus = STATION_IDLE;
+static uint8_t wifiRetries = 0;
+static uint32_t wifiRetryAt = 0;
+static uint8_t leaseState = WIFI_LEASE_NONE;
+static uint32_t leaseConflict = 0;
+static BOOL leaseStatic = FALSE;
+static wifi_lease_t leaseCache;
+static ETSTimer leaseTimer;
+static wifi_arp_t arpCache;
+static BOOL arpSeeded = FALSE;
+
+static void ICACHE_FLASH_ATTR wifi_check_ip(void *arg);
+static void ICACHE_FLASH_ATTR wifi_lease_expire(void *arg);
+
+/*
+ * Checks the lease again once it expires, os_timer_arm takes at most
+ * WIFI_TIMER_MAX seconds.
+ */
+static void ICACHE_FLASH_ATTR wifi_lease_arm(void)
+{
+  int32_t left = leaseCache.expires - (uint32_t)(RTC_GetTime() / 1000000);
+
+  if (left < 1)
+    left = 1;
+  if (left > WIFI_TIMER_MAX)
+    left = WIFI_TIMER_MAX;
+  os_timer_disarm(&leaseTimer);
+  os_timer_setfn(&leaseTimer, (os_timer_func_t *)wifi_lease_expire, NULL);
+  os_timer_arm(&leaseTimer, left * 1000, 0);
+}
+
+static void ICACHE_FLASH_ATTR wifi_lease_put(struct ip_info *ip)
+{
+  leaseCache.ip = ip->ip.addr;
+  leaseCache.netmask = ip->netmask.addr;
+  leaseCache.gw = ip->gw.addr;
+  leaseCache.dns = espconn_dns_getserver(0).addr;
+  leaseCache.expires = RTC_GetTime() / 1000000 + WIFI_LEASE_TTL;
+  RTC_Save(RTC_SLOT_LEASE, &leaseCache, sizeof(leaseCache));
+  wifi_lease_arm();
+}
+
+/*
+ * Leaves the static address and asks DHCP for one.
+ */
+static void ICACHE_FLASH_ATTR wifi_lease_dhcp(void)
+{
+  leaseState = WIFI_LEASE_DHCP;
+  leaseStatic = FALSE;
+  os_timer_disarm(&leaseTimer);
+  wifi_station_disconnect();
+  wifi_station_dhcpc_start();
+  wifi_station_connect();
+}
+
+/*
+ * A static address from the cache goes back to DHCP once its lease is
+ * over. The DHCP client renews its own address, which is only cached
+ * again.
+ */
+static void ICACHE_FLASH_ATTR wifi_lease_expire(void *arg)
+{
+  struct ip_info ipConfig;
+
+  if ((int32_t)(leaseCache.expires - (uint32_t)(RTC_GetTime() / 1000000)) > 0) {
+    wifi_lease_arm();
+    return;
+  }
+  if (leaseStatic) {
+    INFO("WIFI: Cached lease expired, using DHCP\r\n");
+    RTC_Clear(RTC_SLOT_LEASE);
+    wifi_lease_dhcp();
+  } else if (wifi_get_ip_info(STATION_IF, &ipConfig) && ipConfig.ip.addr != 0) {
+    wifi_lease_put(&ipConfig);
+  }
+}
+
+/*
+ * Nobody may answer the probe for the cached address, else it was handed
+ * out again while the lease was cached. The address is only configured
+ * once it turned out to be free.
+ */
+static void ICACHE_FLASH_ATTR wifi_lease_check(void *arg)
+{
+  struct netif *netif = eagle_lwip_getif(STATION_IF);
+  struct ip_info ipConfig;
+  struct eth_addr *eth;
+  ip_addr_t *ip;
+  uint8_t mac[6];
+
+  ipConfig.ip.addr = leaseCache.ip;
+  ipConfig.netmask.addr = leaseCache.netmask;
+  ipConfig.gw.addr = leaseCache.gw;
+  wifi_get_macaddr(STATION_IF, mac);
+  if (netif != NULL && etharp_find_addr(netif, &ipConfig.ip, &eth, &ip) >= 0
+      && os_memcmp(eth->addr, mac, sizeof(mac)) != 0) {
+    INFO("WIFI: Cached address is taken, using DHCP\r\n");
+    leaseConflict = ipConfig.ip.addr;
+    WIFI_DropLease();
+    wifi_lease_dhcp();
+  } else {
+    wifi_set_ip_info(STATION_IF, &ipConfig);
+    leaseState = WIFI_LEASE_BOUND;
+    leaseStatic = TRUE;
+    wifi_lease_arm();
+  }
+  wifi_check_ip(NULL);
+}
+
+/*
+ * Puts the cached next hop into the ARP table of lwIP, as if it had
+ * answered an ARP request. The cache is checked with a real request in
+ * the background, the answer overwrites a stale entry.
+ */
+static void ICACHE_FLASH_ATTR wifi_arp_seed(struct ip_info *ipConfig)
+{
+  struct netif *netif = eagle_lwip_getif(STATION_IF);
+  uint8_t frame[WIFI_ARP_SIZE];
+  struct pbuf *p;
+  ip_addr_t hop;
+
+  arpSeeded = TRUE;
+  if (netif == NULL || !RTC_Load(RTC_SLOT_ARP, &arpCache, sizeof(arpCache)))
+    return;
+  if ((arpCache.ip & ipConfig->netmask.addr) != (ipConfig->ip.addr & ipConfig->netmask.addr))
+    return;
+
+  // Ethernet: to us, from the next hop, ARP
+  wifi_get_macaddr(STATION_IF, frame);
+  os_memcpy(frame + 6, arpCache.mac, 6);
+  frame[12] = 0x08;
+  frame[13] = 0x06;
+  // ARP reply: Ethernet, IPv4, sizes 6 and 4
+  frame[14] = 0x00;
+  frame[15] = 0x01;
+  frame[16] = 0x08;
+  frame[17] = 0x00;
+  frame[18] = 6;
+  frame[19] = 4;
+  frame[20] = 0x00;
+  frame[21] = 0x02;
+  os_memcpy(frame + 22, arpCache.mac, 6);
+  os_memcpy(frame + 28, &arpCache.ip, 4);
+  os_memcpy(frame + 32, frame, 6);
+  os_memcpy(frame + 38, &ipConfig->ip.addr, 4);
+
+  p = pbuf_alloc(WIFI_PBUF_RAW, sizeof(frame), WIFI_PBUF_RAM);
+  if (p == NULL)
+    return;
+  if (pbuf_take(p, frame, sizeof(frame)) != 0) {
+    pbuf_free(p);
+    return;
+  }
+  // Takes the pbuf
+  ethernet_input(p, netif);
+  DEBUG("WIFI: Seeded ARP entry of the next hop\r\n");
+
+  hop.addr = arpCache.ip;
+  etharp_request(netif, &hop);
+}
+
+/*
+ * RFC 5227 probe for the cached address. It is not configured yet, so
+ * lwIP sends the ARP request from 0.0.0.0 and no other host updates its
+ * cache from it. etharp_query leaves a pending entry for the answer of
+ * an owner.
+ */
+static void ICACHE_FLASH_ATTR wifi_lease_probe(void)
+{
+  struct netif *netif = eagle_lwip_getif(STATION_IF);
+  ip_addr_t ip;
+
+  leaseState = WIFI_LEASE_PROBING;
+  ip.addr = leaseCache.ip;
+  if (netif != NULL)
+    etharp_query(netif, &ip, NULL);
+  os_timer_disarm(&WiFiLinker);
+  os_timer_setfn(&WiFiLinker, (os_timer_func_t *)wifi_lease_check, NULL);
+  os_timer_arm(&WiFiLinker, WIFI_ARP_PROBE_TIME, 0);
+}
+
+/*
+ * The probe needs the link, but must go out before the address is set
+ */
+static void ICACHE_FLASH_ATTR wifi_event(System_Event_t *event)
+{
+  if (event->event == EVENT_STAMODE_CONNECTED && leaseState == WIFI_LEASE_CACHED)
+    wifi_lease_probe();
+}
+
+/*
+ * Ask the station to connect again, but back off exponentially instead
+ * of hammering an AP that is gone or overloaded.
+ */
+static void ICACHE_FLASH_ATTR wifi_retry_connect(void)
+{
+  uint32_t now = system_get_time();
+  if (wifiRetries > 0 && (int32_t)(now - wifiRetryAt) < 0)
+    return;
+  wifiRetryAt = now + UTILS_Backoff(WIFI_RETRY_TIMEOUT, WIFI_RETRY_MAX, wifiRetries) * 1000;
+  if (wifiRetries < 255)
+    wifiRetries++;
+  wifi_station_connect();
+}
 static void ICACHE_FLASH_ATTR wifi_check_ip(void *arg)
 {
   struct ip_info ipConfig;
   os_timer_disarm(&WiFiLinker);
   wifi_get_ip_info(STATION_IF, &ipConfig);
   wifiStatus = wifi_station_get_connect_status();
-  if (wifiStatus == STATION_GOT_IP && ipConfig.ip.addr != 0)
+  if (wifiStatus == STATION_GOT_IP && (ipConfig.ip.addr == 0 || ipConfig.ip.addr == leaseConflict
+      || leaseState == WIFI_LEASE_CACHED || leaseState == WIFI_LEASE_PROBING))
+  {
+    // Cached address not checked yet, or still on the address that was
+    // taken and DHCP is not done yet
+    wifiStatus = STATION_CONNECTING;
+  }
+  if (wifiStatus == STATION_GOT_IP)
   {
+    wifiRetries = 0;
+    if (!arpSeeded)
+      wifi_arp_seed(&ipConfig);
+    if (leaseState == WIFI_LEASE_DHCP) {
+      wifi_lease_put(&ipConfig);
+      leaseState = WIFI_LEASE_BOUND;
+    }
     os_timer_setfn(&WiFiLinker, (os_timer_func_t *)wifi_check_ip, NULL);
-    os_timer_arm(&WiFiLinker, 2000, 0);
+    os_timer_arm(&WiFiLinker, WIFI_CHECK_INTERVAL, 0);
   }
   else
   {
     if (wifi_station_get_connect_status() == STATION_WRONG_PASSWORD)
     {
       INFO("STATION_WRONG_PASSWORD\r\n");
-      wifi_station_connect();
+      wifi_retry_connect();
     }
     else if (wifi_station_get_connect_status() == STATION_NO_AP_FOUND)
     {
       INFO("STATION_NO_AP_FOUND\r\n");
-      wifi_station_connect();
+      wifi_retry_connect();
     }
     else if (wifi_station_get_connect_status() == STATION_CONNECT_FAIL)
     {
       INFO("STATION_CONNECT_FAIL\r\n");
-      wifi_station_connect();
+      wifi_retry_connect();
     }
 
     os_timer_setfn(&WiFiLinker, (os_timer_func_t *)wifi_check_ip, NULL);
@@ -64,6 +345,7 @@ void ICACHE_FLASH_ATTR WIFI_Connect_IP(uint8_t* ssid, uint8_t* pass, struct ip_i
   wifi_station_dhcpc_stop();
   wifi_set_ip_info(STATION_IF, ip);
 
+  leaseState = WIFI_LEASE_NONE;
   wifiCb = cb;
   os_memset(&stationConf, 0, sizeof(struct station_config));
   os_sprintf(stationConf.ssid, "%s", ssid);
@@ -91,3 +373,69 @@ void ICACHE_FLASH_ATTR WIFI_Connect(uint8_t* ssid, uint8_t* pass, WifiCallback c
   wifi_station_connect();
 }
 
+/*
+ * Connects with the address of the cached DHCP lease, which saves the
+ * DHCP round trip. The address is probed once the link is up and taken
+ * if nobody answers. Without a lease, if the address turns out to be
+ * taken or the lease expires, DHCP runs and its lease gets cached for
+ * WIFI_LEASE_TTL.
+ */
+void ICACHE_FLASH_ATTR WIFI_Connect_Lease(uint8_t* ssid, uint8_t* pass, WifiCallback cb)
+{
+  struct ip_info ip;
+
+  if (RTC_Load(RTC_SLOT_LEASE, &leaseCache, sizeof(leaseCache))
+      && (int32_t)(leaseCache.expires - (uint32_t)(RTC_GetTime() / 1000000)) > 0) {
+    INFO("WIFI: Cached lease, %d s left\r\n", leaseCache.expires - (uint32_t)(RTC_GetTime() / 1000000));
+    os_memset(&ip, 0, sizeof(ip));
+    WIFI_Connect_IP(ssid, pass, &ip, cb);
+    if (leaseCache.dns != 0) {
+      ip.ip.addr = leaseCache.dns;
+      espconn_dns_setserver(0, &ip.ip);
+    }
+    leaseState = WIFI_LEASE_CACHED;
+    wifi_set_event_handler_cb(wifi_event);
+  } else {
+    wifi_set_opmode_current(STATION_MODE);
+    wifi_station_dhcpc_start();
+    WIFI_Connect(ssid, pass, cb);
+    leaseState = WIFI_LEASE_DHCP;
+  }
+}
+
+/*
+ * Forgets the cached lease and next hop, the next connect runs DHCP and
+ * ARP.
+ */
+void ICACHE_FLASH_ATTR WIFI_DropLease(void)
+{
+  RTC_Clear(RTC_SLOT_LEASE);
+  RTC_Clear(RTC_SLOT_ARP);
+}
+
+/*
+ * Caches the MAC of the next hop to dest, once lwIP has resolved it. The
+ * next wake seeds the ARP table with it.
+ */
+void ICACHE_FLASH_ATTR WIFI_CacheNextHop(const uint8_t *dest)
+{
+  struct netif *netif = eagle_lwip_getif(STATION_IF);
+  struct ip_info ipConfig;
+  struct eth_addr *eth;
+  ip_addr_t *ip;
+  ip_addr_t hop;
+
+  if (netif == NULL || !wifi_get_ip_info(STATION_IF, &ipConfig))
+    return;
+  os_memcpy(&hop.addr, dest, 4);
+  if ((hop.addr & ipConfig.netmask.addr) != (ipConfig.ip.addr & ipConfig.netmask.addr))
+    hop.addr = ipConfig.gw.addr;
+  if (etharp_find_addr(netif, &hop, &eth, &ip) < 0)
+    return;
+  if (arpCache.ip == hop.addr && os_memcmp(arpCache.mac, eth->addr, 6) == 0)
+    return;
+  arpCache.ip = hop.addr;
+  os_memcpy(arpCache.mac, eth->addr, 6);
+  arpCache.pad = 0;
+  RTC_Save(RTC_SLOT_ARP, &arpCache, sizeof(arpCache));
+}
@@ -0,0 +1,23 @@
+#ifndef TEST_BENCH_H_
+#define TEST_BENCH_H_
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Runs body runs times and prints the mean time per run. Host numbers,
+ * only the ratio between two runs says something about the lx106.
+ */
+#define BENCH(name, runs, body) do { \
+	struct timespec b_, e_; \
+	long i_; \
+	clock_gettime(CLOCK_MONOTONIC, &b_); \
+	for (i_ = 0; i_ < (runs); i_++) { \
+		body; \
+	} \
+	clock_gettime(CLOCK_MONOTONIC, &e_); \
+	printf("%-24s %8.1f ns\n", name, \
+			((e_.tv_sec - b_.tv_sec) * 1e9 + (e_.tv_nsec - b_.tv_nsec)) / (runs)); \
+} while (0)
+
+#endif /* TEST_BENCH_H_ */
@@ -0,0 +1,57 @@
+/*
+ * Fixed-point decoding against the float path it replaced: DHT22 bytes to
+ * the two payload values, once through float scaling and the "%d.%d"
+ * split, once through DHTTemperature, DHTHumidity and PAYLOAD_Centi.
+ */
+#include <stdio.h>
+#include "bench.h"
+#include "dht_decode.h"
+#include "payload.h"
+
+#define RUNS	1000000
+
+static volatile int sink;
+
+static void float_path(const uint8_t *data) {
+	char buf[64];
+	float temperature, humidity;
+	int len;
+
+	humidity = data[0] * 256 + data[1];
+	humidity /= 10;
+	temperature = data[2] & 0x7f;
+	temperature *= 256;
+	temperature += data[3];
+	temperature /= 10;
+	if (data[2] & 0x80) {
+		temperature *= -1;
+	}
+	if (temperature < 0) {
+		temperature *= -1;
+		len = snprintf(buf, sizeof(buf), "-%d.%d,%d.%d", (int) temperature, (int) ((temperature - (int) temperature) * 100),
+				(int) humidity, (int) ((humidity - (int) humidity) * 100));
+	} else {
+		len = snprintf(buf, sizeof(buf), "%d.%d,%d.%d", (int) temperature, (int) ((temperature - (int) temperature) * 100),
+				(int) humidity, (int) ((humidity - (int) humidity) * 100));
+	}
+	sink = len;
+}
+
+static void fixed_path(const uint8_t *data) {
+	char buf[64];
+	PAYLOAD_Writer w;
+
+	PAYLOAD_Init(&w, buf, sizeof(buf));
+	PAYLOAD_Centi(&w, DHTTemperature(data));
+	PAYLOAD_Char(&w, ',');
+	PAYLOAD_Centi(&w, DHTHumidity(data));
+	sink = PAYLOAD_Length(&w);
+}
+
+int main(void) {
+	uint8_t data[4] = { 0x01, 0xC2, 0x00, 0xC8 };
+
+	BENCH("float, %d.%d", RUNS, (data[3] = i_, data[2] = (i_ >> 8) & 0x81, float_path(data)));
+	BENCH("fixed, PAYLOAD_Centi", RUNS, (data[3] = i_, data[2] = (i_ >> 8) & 0x81, fixed_path(data)));
+	return 0;
+}
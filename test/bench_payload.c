@@ -0,0 +1,75 @@
+/*
+ * The payload writer against the os_sprintf chain it replaced: the same
+ * topic and reading, built the old way with three heap buffers and
+ * snprintf, and with PAYLOAD_ into stack buffers.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "payload.h"
+
+#define RUNS	1000000
+
+static volatile int sink;
+
+static void old_path(int temperature, int humidity) {
+	char *topicBuf = calloc(1, 128);
+	char *id = calloc(1, 32);
+	char *dataBuf = calloc(1, 256);
+	int len = 0;
+
+	snprintf(id, 32, "%08X", 0xA1B2Cu);
+	snprintf(topicBuf, 128, "%s/%s/%s", "/sensors", id, "dht22");
+	len += snprintf(dataBuf + len, 256 - len, "{\"status\":\"OK\"");
+	len += snprintf(dataBuf + len, 256 - len, ",\"temperature\":%d.%d", temperature / 100, temperature % 100);
+	len += snprintf(dataBuf + len, 256 - len, ",\"humidity\":%d.%d", humidity / 100, humidity % 100);
+	len += snprintf(dataBuf + len, 256 - len, "}");
+	sink = len + topicBuf[0];
+	free(id);
+	free(topicBuf);
+	free(dataBuf);
+}
+
+static void old_format(int temperature, int humidity) {
+	char topicBuf[128];
+	char id[32];
+	char dataBuf[256];
+	int len = 0;
+
+	snprintf(id, sizeof(id), "%08X", 0xA1B2Cu);
+	snprintf(topicBuf, sizeof(topicBuf), "%s/%s/%s", "/sensors", id, "dht22");
+	len += snprintf(dataBuf + len, sizeof(dataBuf) - len, "{\"status\":\"OK\"");
+	len += snprintf(dataBuf + len, sizeof(dataBuf) - len, ",\"temperature\":%d.%d", temperature / 100, temperature % 100);
+	len += snprintf(dataBuf + len, sizeof(dataBuf) - len, ",\"humidity\":%d.%d", humidity / 100, humidity % 100);
+	len += snprintf(dataBuf + len, sizeof(dataBuf) - len, "}");
+	sink = len + topicBuf[0];
+}
+
+static void new_path(int temperature, int humidity) {
+	char topicBuf[128];
+	char dataBuf[256];
+	PAYLOAD_Writer topic, data;
+
+	PAYLOAD_Init(&topic, topicBuf, sizeof(topicBuf));
+	PAYLOAD_Raw(&topic, "/sensors/", 9);
+	PAYLOAD_Hex(&topic, 0xA1B2C, 8);
+	PAYLOAD_Raw(&topic, "/dht22", 7);
+	PAYLOAD_Init(&data, dataBuf, sizeof(dataBuf));
+	PAYLOAD_Char(&data, '{');
+	PAYLOAD_Key(&data, "status");
+	PAYLOAD_String(&data, "OK");
+	PAYLOAD_Key(&data, "temperature");
+	PAYLOAD_Centi(&data, temperature);
+	PAYLOAD_Key(&data, "humidity");
+	PAYLOAD_Centi(&data, humidity);
+	PAYLOAD_Char(&data, '}');
+	PAYLOAD_Char(&data, '\0');
+	sink = PAYLOAD_Length(&data) + topicBuf[0];
+}
+
+int main(void) {
+	BENCH("os_sprintf, 3 allocs", RUNS, old_path(2005 + (i_ & 7), 4510));
+	BENCH("os_sprintf, no heap", RUNS, old_format(2005 + (i_ & 7), 4510));
+	BENCH("PAYLOAD_, no heap", RUNS, new_path(2005 + (i_ & 7), 4510));
+	return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef TEST_CHECK_H_
+#define TEST_CHECK_H_
+
+#include <stdio.h>
+
+/*
+ * Counts failed checks and keeps going, main returns the count
+ */
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+	long a_ = (long) (actual), e_ = (long) (expected); \
+	if (a_ != e_) { \
+		printf("%s:%d: %s is %ld, expected %ld\n", __FILE__, __LINE__, #actual, a_, e_); \
+		failures++; \
+	} \
+} while (0)
+
+#define CHECK_DONE(name) do { \
+	printf("%s: %s\n", name, failures ? "FAILED" : "ok"); \
+	return failures != 0; \
+} while (0)
+
+#endif /* TEST_CHECK_H_ */
@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for the cycle counter of modules/onewire, the test moves
+ * the virtual clock
+ */
+#ifndef MODULES_INCLUDE_CCOUNT_H_
+#define MODULES_INCLUDE_CCOUNT_H_
+
+#include <c_types.h>
+
+uint32_t OW_CCount(void);
+
+#endif
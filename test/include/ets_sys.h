@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for ets_sys.h of the SDK, only what the tested modules use
+ */
+#ifndef _ETS_SYS_H
+#define _ETS_SYS_H
+
+#include <c_types.h>
+
+void ets_intr_lock(void);
+void ets_intr_unlock(void);
+
+#define ETS_INTR_LOCK()		ets_intr_lock()
+#define ETS_INTR_UNLOCK()	ets_intr_unlock()
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for gpio.h of the SDK: the registers go to the test's
+ * virtual bus
+ */
+#ifndef _GPIO_H_
+#define _GPIO_H_
+
+#include <c_types.h>
+
+#define GPIO_ID_PIN(n)				(n)
+
+#define GPIO_OUT_W1TS_ADDRESS		0x04
+#define GPIO_OUT_W1TC_ADDRESS		0x08
+#define GPIO_ENABLE_W1TS_ADDRESS	0x10
+#define GPIO_ENABLE_W1TC_ADDRESS	0x14
+#define GPIO_IN_ADDRESS				0x18
+
+uint32 stub_gpio_read(uint32 reg);
+void stub_gpio_write(uint32 reg, uint32 value);
+
+#define GPIO_REG_READ(reg)			stub_gpio_read(reg)
+#define GPIO_REG_WRITE(reg, value)	stub_gpio_write(reg, value)
+
+#endif
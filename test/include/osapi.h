@@ -0,0 +1,29 @@
+/*
+ * Host stand-in for osapi.h of the SDK, only what the tested modules use.
+ * The timers only fire when a test calls stub_timer_fire, see stub_sdk.c.
+ */
+#ifndef _OSAPI_H_
+#define _OSAPI_H_
+
+#include <string.h>
+#include <c_types.h>
+
+#define os_memcpy	memcpy
+#define os_memset	memset
+#define os_memcmp	memcmp
+#define os_strlen	strlen
+
+typedef void os_timer_func_t(void *arg);
+
+typedef struct {
+	os_timer_func_t *func;
+	void *arg;
+	uint32 ms;
+	bool armed;
+} ETSTimer;
+
+void os_timer_setfn(ETSTimer *timer, os_timer_func_t *func, void *arg);
+void os_timer_arm(ETSTimer *timer, uint32 ms, bool repeat);
+void os_timer_disarm(ETSTimer *timer);
+
+#endif
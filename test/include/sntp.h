@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for sntp.h of the SDK, see stub_sdk.c
+ */
+#ifndef __SNTP_H__
+#define __SNTP_H__
+
+#include <c_types.h>
+
+uint32 sntp_get_current_timestamp(void);
+void sntp_setservername(unsigned char idx, char *server);
+bool sntp_set_timezone(sint8 timezone);
+void sntp_init(void);
+void sntp_stop(void);
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for include/user_config.h, the Makefile sets DHT_TYPE and
+ * DS1820_ENABLE per test build
+ */
+#ifndef __USER_CONFIG_H__
+#define __USER_CONFIG_H__
+
+#include <c_types.h>
+
+#define ERROR( format, ... )
+#define WARN( format, ... )
+#define INFO( format, ... )
+#define DEBUG( format, ... )
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Host stand-in for user_interface.h of the SDK, only what the tested
+ * modules use. The tests define the functions.
+ */
+#ifndef __USER_INTERFACE_H__
+#define __USER_INTERFACE_H__
+
+#include <c_types.h>
+
+enum rst_reason {
+	REASON_DEFAULT_RST = 0,
+	REASON_WDT_RST,
+	REASON_EXCEPTION_RST,
+	REASON_SOFT_WDT_RST,
+	REASON_SOFT_RESTART,
+	REASON_DEEP_SLEEP_AWAKE,
+	REASON_EXT_SYS_RST
+};
+
+struct rst_info {
+	uint32 reason;
+	uint32 exccause;
+	uint32 epc1;
+	uint32 epc2;
+	uint32 epc3;
+	uint32 excvaddr;
+	uint32 depc;
+};
+
+struct rst_info *system_get_rst_info(void);
+uint32 system_get_time(void);
+uint32 system_get_chip_id(void);
+uint8 system_get_cpu_freq(void);
+
+#endif
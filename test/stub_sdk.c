@@ -0,0 +1,120 @@
+/*
+ * Host stand-ins for the RTC memory, the system clock, timers and SNTP.
+ * RTC memory survives stub_deep_sleep and is lost on stub_power_cycle.
+ */
+#include <string.h>
+#include "user_interface.h"
+#include "sntp.h"
+#include "rtcmem.h"
+#include "stub_sdk.h"
+
+#define SLOT_SIZE	64
+
+uint64 stub_rtc_time = 0;
+uint32 stub_system_time = 0;
+uint32 stub_reset_reason = REASON_DEFAULT_RST;
+uint32 stub_chip_id = 0xA1B2C;
+uint8 stub_cpu_mhz = 80;
+uint32 stub_sntp_time = 0;
+uint64 stub_sntp_answer = 0;
+bool stub_sntp_running = FALSE;
+
+static uint8_t rtc_data[RTC_SLOT_END][SLOT_SIZE];
+static uint16_t rtc_size[RTC_SLOT_END];
+
+void stub_deep_sleep(uint32 sleep_us, int32_t skew_ppm, uint32 awake_us) {
+	stub_rtc_time += sleep_us + (int64_t) sleep_us * skew_ppm / 1000000 + awake_us;
+	stub_system_time = awake_us;
+	stub_reset_reason = REASON_DEEP_SLEEP_AWAKE;
+}
+
+void stub_power_cycle(void) {
+	memset(rtc_size, 0, sizeof(rtc_size));
+	stub_rtc_time = 0;
+	stub_system_time = 0;
+	stub_reset_reason = REASON_DEFAULT_RST;
+}
+
+bool stub_timer_fire(ETSTimer *timer) {
+	if (!timer->armed) {
+		return FALSE;
+	}
+	timer->armed = FALSE;
+	timer->func(timer->arg);
+	return TRUE;
+}
+
+void os_timer_setfn(ETSTimer *timer, os_timer_func_t *func, void *arg) {
+	timer->func = func;
+	timer->arg = arg;
+}
+
+void os_timer_arm(ETSTimer *timer, uint32 ms, bool repeat) {
+	timer->ms = ms;
+	timer->armed = TRUE;
+}
+
+void os_timer_disarm(ETSTimer *timer) {
+	timer->armed = FALSE;
+}
+
+uint32 sntp_get_current_timestamp(void) {
+	if (!stub_sntp_running || stub_sntp_answer == 0 || stub_rtc_time < stub_sntp_answer) {
+		return 0;
+	}
+	return stub_sntp_time;
+}
+
+void sntp_setservername(unsigned char idx, char *server) {
+}
+
+bool sntp_set_timezone(sint8 timezone) {
+	return TRUE;
+}
+
+void sntp_init(void) {
+	stub_sntp_running = TRUE;
+}
+
+void sntp_stop(void) {
+	stub_sntp_running = FALSE;
+}
+
+struct rst_info *system_get_rst_info(void) {
+	static struct rst_info info;
+	info.reason = stub_reset_reason;
+	return &info;
+}
+
+uint32 system_get_time(void) {
+	return stub_system_time;
+}
+
+uint32 system_get_chip_id(void) {
+	return stub_chip_id;
+}
+
+uint8 system_get_cpu_freq(void) {
+	return stub_cpu_mhz;
+}
+
+BOOL RTC_Load(uint8_t slot, void *data, uint16_t size) {
+	if (rtc_size[slot] != size) {
+		return FALSE;
+	}
+	memcpy(data, rtc_data[slot], size);
+	return TRUE;
+}
+
+void RTC_Save(uint8_t slot, const void *data, uint16_t size) {
+	memcpy(rtc_data[slot], data, size);
+	rtc_size[slot] = size;
+}
+
+void RTC_Clear(uint8_t slot) {
+	rtc_size[slot] = 0;
+}
+
+uint64 RTC_GetTime(void) {
+	return stub_rtc_time;
+}
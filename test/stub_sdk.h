@@ -0,0 +1,38 @@
+#ifndef TEST_STUB_SDK_H_
+#define TEST_STUB_SDK_H_
+
+#include <c_types.h>
+#include <osapi.h>
+
+/*
+ * Simulated clocks, timers, SNTP and RTC memory for the modules that keep
+ * time, see stub_sdk.c. The tests move the clocks.
+ */
+extern uint64 stub_rtc_time;		/* RTC_GetTime, us */
+extern uint32 stub_system_time;		/* system_get_time, us since the reset */
+extern uint32 stub_reset_reason;
+extern uint32 stub_chip_id;
+extern uint8 stub_cpu_mhz;
+
+/*
+ * SNTP server stand-in: answers with stub_sntp_time once sntp_init was
+ * called and stub_rtc_time reached stub_sntp_answer, 0 means it never does
+ */
+extern uint32 stub_sntp_time;
+extern uint64 stub_sntp_answer;
+extern bool stub_sntp_running;
+
+/*
+ * Deep sleep of sleep_us on a clock that runs skew_ppm fast, plus awake_us
+ * after the wake
+ */
+void stub_deep_sleep(uint32 sleep_us, int32_t skew_ppm, uint32 awake_us);
+void stub_power_cycle(void);
+
+/*
+ * Runs the timer if it is armed, a one shot timer is disarmed first.
+ * Returns FALSE if it was not armed.
+ */
+bool stub_timer_fire(ETSTimer *timer);
+
+#endif /* TEST_STUB_SDK_H_ */
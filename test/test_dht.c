@@ -0,0 +1,224 @@
+/*
+ * Host tests of the DHT and DS18B20 decoding, built once with DHT_TYPE
+ * DHT11 and once with DHT22. The pulse trains model captures of the high
+ * widths in us: ~26 for 0 and ~70 for 1, with jitter, interrupts and a
+ * weak pull-up.
+ */
+#include <string.h>
+#include "check.h"
+#include "dht_decode.h"
+
+/* DHT22 at 80 MHz: 65.2 %, 35.1 C */
+static const uint8_t dht22_80mhz[40] = {
+	25, 28, 24, 26, 24, 27, 71, 27,
+	73, 27, 25, 24, 71, 68, 27, 27,
+	28, 24, 27, 26, 25, 28, 24, 70,
+	24, 68, 24, 73, 72, 68, 71, 73,
+	69, 71, 73, 24, 72, 69, 71, 27
+};
+
+/* DHT22 at 160 MHz, two zeros stretched by interrupts: 40.0 %, -10.1 C */
+static const uint8_t dht22_160mhz_irq[40] = {
+	22, 23, 23, 27, 24, 35, 26, 68,
+	63, 31, 24, 75, 28, 30, 27, 30,
+	76, 41, 26, 22, 22, 27, 29, 27,
+	28, 75, 78, 24, 30, 67, 25, 69,
+	22, 67, 72, 67, 24, 78, 78, 27
+};
+
+/* DHT11 at 80 MHz: 45 %, 23 C */
+static const uint8_t dht11_80mhz[40] = {
+	26, 29, 73, 26, 71, 73, 28, 74,
+	29, 25, 29, 25, 28, 27, 29, 26,
+	26, 28, 29, 73, 28, 72, 74, 70,
+	26, 26, 29, 28, 25, 25, 26, 29,
+	25, 71, 25, 27, 28, 73, 28, 28
+};
+
+/* DHT11 with all bits 0: 0 %, 0 C, no gap to split at */
+static const uint8_t dht11_zero[40] = {
+	25, 26, 24, 29, 27, 27, 25, 24,
+	24, 24, 27, 28, 26, 24, 25, 28,
+	28, 26, 26, 25, 24, 26, 25, 24,
+	29, 26, 26, 25, 25, 26, 26, 29,
+	29, 26, 24, 28, 26, 29, 27, 28
+};
+
+/* DHT22 with a weak pull-up, 0 and 1 only 13 us apart: 50.0 %, 20.0 C */
+static const uint8_t dht22_narrow[40] = {
+	36, 36, 34, 37, 35, 34, 35, 50,
+	52, 53, 51, 53, 34, 54, 35, 34,
+	35, 37, 36, 35, 37, 35, 34, 35,
+	54, 54, 37, 35, 51, 34, 34, 35,
+	51, 35, 51, 52, 52, 51, 35, 51
+};
+
+static void check_train(const uint8_t *highs, uint8_t response, uint8_t threshold, uint8_t margin,
+		const uint8_t *expected) {
+	uint8_t data[5], m;
+
+	CHECK_EQ(DHTBitThreshold(highs, response, &m), threshold);
+	CHECK_EQ(m, margin);
+	DHTBits(highs, threshold, data);
+	CHECK(memcmp(data, expected, sizeof(data)) == 0);
+}
+
+static void test_split(void) {
+	static const uint8_t dht22_a[5] = { 0x02, 0x8C, 0x01, 0x5F, 0xEE };
+	static const uint8_t dht22_b[5] = { 0x01, 0x90, 0x80, 0x65, 0x76 };
+	static const uint8_t dht11[5] = { 0x2D, 0x00, 0x17, 0x00, 0x44 };
+
+	// Midway between the longest 0 and the shortest 1
+	check_train(dht22_80mhz, 80, 48, 20, dht22_a);
+	check_train(dht22_160mhz_irq, 80, 52, 11, dht22_b);
+	check_train(dht11_80mhz, 80, 50, 20, dht11);
+	// The response pulse does not matter once there is a gap
+	check_train(dht22_80mhz, 120, 48, 20, dht22_a);
+}
+
+static void test_fallback(void) {
+	static const uint8_t zero[5] = { 0, 0, 0, 0, 0 };
+	static const uint8_t narrow[5] = { 0x01, 0xF4, 0x00, 0xC8, 0xBD };
+	uint8_t margin;
+
+	// No gap of DHT_MIN_SPLIT, 3/5 of the response pulse
+	check_train(dht11_zero, 80, 48, 19, zero);
+	check_train(dht22_narrow, 80, 48, 2, narrow);
+	CHECK_EQ(DHTBitThreshold(dht11_zero, 90, &margin), 54);
+	CHECK_EQ(DHTBitThreshold(dht11_zero, 0xFF, &margin), 153);
+}
+
+static void test_skew(void) {
+	uint8_t highs[40], margin;
+	int skew;
+	uint8_t i;
+
+	// Every pulse measured longer or shorter by the same amount
+	for (skew = -20; skew <= 40; skew += 5) {
+		for (i = 0; i < 40; i++) {
+			highs[i] = dht22_80mhz[i] + skew;
+		}
+		CHECK_EQ(DHTBitThreshold(highs, 80 + skew, &margin), 48 + skew);
+		CHECK_EQ(margin, 20);
+	}
+}
+
+#if DHT_TYPE == DHT22
+static void test_dht22(void) {
+	uint8_t data[5] = { 0, 0, 0, 0, 0 };
+	int32_t raw;
+
+	// 40.0 %, -10.1 C from the pulse train
+	DHTBits(dht22_160mhz_irq, 52, data);
+	CHECK_EQ(DHTHumidity(data), 4000);
+	CHECK_EQ(DHTTemperature(data), -1010);
+
+	// Sign and magnitude, not two's complement
+	data[2] = 0x80;
+	data[3] = 0x01;
+	CHECK_EQ(DHTTemperature(data), -10);
+	data[3] = 0x00;
+	CHECK_EQ(DHTTemperature(data), 0);
+
+	// The range of the sensor, -40.0 to 80.0 C and 0.0 to 100.0 %
+	for (raw = -400; raw <= 800; raw++) {
+		uint16_t magnitude = raw < 0 ? -raw : raw;
+		data[2] = (magnitude >> 8) | (raw < 0 ? 0x80 : 0);
+		data[3] = magnitude & 0xFF;
+		CHECK_EQ(DHTTemperature(data), raw * 10);
+	}
+	for (raw = 0; raw <= 1000; raw++) {
+		data[0] = raw >> 8;
+		data[1] = raw & 0xFF;
+		CHECK_EQ(DHTHumidity(data), raw * 10);
+	}
+}
+#endif
+
+#if DHT_TYPE == DHT11
+static void test_dht11(void) {
+	uint8_t data[5] = { 0, 0, 0, 0, 0 };
+	int32_t raw;
+
+	// 45 %, 23 C from the pulse train, the fraction bytes stay 0
+	DHTBits(dht11_80mhz, 50, data);
+	CHECK_EQ(DHTHumidity(data), 4500);
+	CHECK_EQ(DHTTemperature(data), 2300);
+
+	// The range of the sensor, 0 to 50 C and 20 to 90 %
+	for (raw = 0; raw <= 50; raw++) {
+		data[2] = raw;
+		CHECK_EQ(DHTTemperature(data), raw * 100);
+	}
+	for (raw = 20; raw <= 90; raw++) {
+		data[0] = raw;
+		CHECK_EQ(DHTHumidity(data), raw * 100);
+	}
+}
+#endif
+
+static void test_ds18b20(void) {
+	int32_t raw;
+
+	// 1/16 degree, rounded half away from zero
+	CHECK_EQ(DHTScaleDS18B20(0), 0);
+	CHECK_EQ(DHTScaleDS18B20(1), 6);
+	CHECK_EQ(DHTScaleDS18B20(2), 13);
+	CHECK_EQ(DHTScaleDS18B20(-1), -6);
+	CHECK_EQ(DHTScaleDS18B20(-2), -13);
+	CHECK_EQ(DHTScaleDS18B20(0x0191), 2506);
+	CHECK_EQ(DHTScaleDS18B20(0xFF5E), -1013);
+	CHECK_EQ(DHTScaleDS18B20(0x07D0), 12500);
+	CHECK_EQ(DHTScaleDS18B20(0xFC90), -5500);
+
+	// The range of the sensor, -55 to 125 C
+	for (raw = -55 * 16; raw <= 125 * 16; raw++) {
+		int32_t centi = raw * 100;
+		int32_t rounded = centi >= 0 ? (centi + 8) / 16 : -((-centi + 8) / 16);
+		CHECK_EQ(DHTScaleDS18B20(raw), rounded);
+	}
+}
+
+static void test_combine(void) {
+	static const int16_t t3[] = { 2100, 2110, 3500 };
+	static const uint16_t h3[] = { 4500, 4520, 4510 };
+	static const int16_t t2[] = { 2100, 2900 };
+	static const uint16_t h2[] = { 4500, 4500 };
+	static const int16_t t4[] = { 2100, 2120, 2110, -4000 };
+	static const uint16_t h4[] = { 4500, 4500, 9990, 4510 };
+	int16_t t;
+	uint16_t h;
+
+	// The odd one out is dropped, the median of the rest is the mean of two
+	CHECK_EQ(DHTCombine(t3, h3, 3, &t, &h), 2);
+	CHECK_EQ(t, 2105);
+	CHECK_EQ(h, 4510);
+
+	// Two that disagree: neither is trusted, the mean stays
+	CHECK_EQ(DHTCombine(t2, h2, 2, &t, &h), 0);
+	CHECK_EQ(t, 2500);
+
+	// A sample is dropped if either value is off
+	CHECK_EQ(DHTCombine(t4, h4, 4, &t, &h), 2);
+	CHECK_EQ(t, 2110);
+	CHECK_EQ(h, 4500);
+
+	CHECK_EQ(DHTCombine(t3, h3, 1, &t, &h), 1);
+	CHECK_EQ(t, 2100);
+	CHECK_EQ(h, 4500);
+}
+
+int main(void) {
+	test_split();
+	test_fallback();
+	test_skew();
+	test_combine();
+#if DHT_TYPE == DHT22
+	test_dht22();
+#endif
+#if DHT_TYPE == DHT11
+	test_dht11();
+#endif
+	test_ds18b20();
+	CHECK_DONE(DHT_TYPE == DHT22 ? "dht22" : "dht11");
+}
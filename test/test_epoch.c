@@ -0,0 +1,127 @@
+/*
+ * Host tests of the wall clock against an SNTP stand-in. epoch.c is
+ * included, so boot() can reset its statics the way a reset does.
+ */
+#include "check.h"
+#include "stub_sdk.h"
+#include "../modules/epoch/epoch.c"
+
+#define UNIX	1700000000UL
+
+static void boot(uint32 reason) {
+	loaded = FALSE;
+	syncing = FALSE;
+	os_timer_disarm(&poll_timer);
+	stub_reset_reason = reason;
+	stub_system_time = 0;
+	stub_sntp_running = FALSE;
+}
+
+/*
+ * Advances both clocks by ms and runs the poll timer, if armed
+ */
+static void run(uint32 ms) {
+	stub_rtc_time += (uint64) ms * 1000;
+	stub_system_time += ms * 1000;
+	stub_timer_fire(&poll_timer);
+}
+
+static void test_sync(void) {
+	stub_power_cycle();
+	boot(REASON_DEFAULT_RST);
+	stub_rtc_time = 3000000;
+	CHECK(!EPOCH_Valid());
+	CHECK_EQ(EPOCH_At(RTC_GetTime()), 0);
+
+	// The answer comes 300 ms later
+	stub_sntp_time = UNIX;
+	stub_sntp_answer = stub_rtc_time + 300000;
+	EPOCH_Sync();
+	CHECK(EPOCH_Syncing());
+	run(100);
+	run(100);
+	CHECK(EPOCH_Syncing());
+	CHECK(!EPOCH_Valid());
+	run(100);
+	CHECK(!EPOCH_Syncing());
+	CHECK(!stub_sntp_running);
+	CHECK(EPOCH_Valid());
+	CHECK_EQ(EPOCH_At(stub_sntp_answer), UNIX);
+	CHECK_EQ(EPOCH_At(stub_sntp_answer - 1000000), UNIX - 1);
+	CHECK_EQ(EPOCH_At(stub_sntp_answer + 59999999), UNIX + 59);
+
+	// Fresh, no SNTP on the next call
+	EPOCH_Sync();
+	CHECK(!EPOCH_Syncing());
+}
+
+static void test_wake(void) {
+	uint64 synced;
+
+	test_sync();
+	synced = stub_sntp_answer;
+
+	// The offset survives deep sleep, the RTC clock goes on
+	stub_sntp_answer = 0;
+	stub_deep_sleep(600000000, 0, 0);
+	boot(REASON_DEEP_SLEEP_AWAKE);
+	CHECK(EPOCH_Valid());
+	CHECK_EQ(EPOCH_At(RTC_GetTime()), UNIX + (stub_rtc_time - synced) / 1000000);
+	EPOCH_Sync();
+	CHECK(!EPOCH_Syncing());
+
+	// Again once EPOCH_SYNC_INTERVAL is over, the old offset stays in use
+	while (RTC_GetTime() / 1000000 - synced / 1000000 < EPOCH_SYNC_INTERVAL) {
+		stub_deep_sleep(0xFFFFFFFF, 0, 0);
+	}
+	boot(REASON_DEEP_SLEEP_AWAKE);
+	EPOCH_Sync();
+	CHECK(EPOCH_Syncing());
+	CHECK(EPOCH_Valid());
+}
+
+static void test_reset(void) {
+	static const uint32 reasons[] = {
+		REASON_WDT_RST, REASON_EXCEPTION_RST, REASON_SOFT_WDT_RST, REASON_SOFT_RESTART, REASON_EXT_SYS_RST
+	};
+	uint8_t i;
+
+	// RTC memory survives these, but the offset is not trusted
+	for (i = 0; i < sizeof(reasons) / sizeof(reasons[0]); i++) {
+		test_sync();
+		boot(reasons[i]);
+		CHECK(!EPOCH_Valid());
+		CHECK_EQ(EPOCH_At(RTC_GetTime()), 0);
+		EPOCH_Sync();
+		CHECK(EPOCH_Syncing());
+		// Also not on the deep sleep wake after it
+		stub_deep_sleep(1000000, 0, 0);
+		boot(REASON_DEEP_SLEEP_AWAKE);
+		CHECK(!EPOCH_Valid());
+	}
+}
+
+static void test_timeout(void) {
+	uint32 waited = 0;
+
+	stub_power_cycle();
+	boot(REASON_DEFAULT_RST);
+	stub_sntp_answer = 0;
+	EPOCH_Sync();
+	while (EPOCH_Syncing() && waited < 2 * EPOCH_SYNC_TIMEOUT) {
+		run(POLL_INTERVAL);
+		waited += POLL_INTERVAL;
+	}
+	CHECK(!EPOCH_Syncing());
+	CHECK(!stub_sntp_running);
+	CHECK(waited >= EPOCH_SYNC_TIMEOUT && waited <= EPOCH_SYNC_TIMEOUT + POLL_INTERVAL);
+	CHECK(!EPOCH_Valid());
+}
+
+int main(void) {
+	test_sync();
+	test_wake();
+	test_reset();
+	test_timeout();
+	CHECK_DONE("epoch");
+}
@@ -0,0 +1,137 @@
+/*
+ * Host tests of the MQTT-SN encoding. A stand-in for the gateway parses
+ * what the client would send, the way the spec describes it.
+ */
+#include <string.h>
+#include "check.h"
+#include "mqttsn_msg.h"
+
+#define PAYLOAD_SIZE	384	/* user_main.c */
+
+typedef struct {
+	int type;
+	uint16_t length;		/* as announced in the header */
+	const uint8_t *body;
+	uint16_t body_length;
+} gateway_packet;
+
+/*
+ * Returns FALSE if the datagram is not a single well formed packet
+ */
+static BOOL gateway_parse(const uint8_t *buf, uint16_t len, gateway_packet *p) {
+	uint16_t offset;
+
+	p->type = mqttsn_get_type(buf, len, &offset);
+	if (p->type < 0) {
+		return FALSE;
+	}
+	p->length = buf[0] == 0x01 ? (buf[1] << 8 | buf[2]) : buf[0];
+	// The short form is only for packets below 256 bytes
+	if (buf[0] == 0x01 && p->length < 256) {
+		return FALSE;
+	}
+	p->body = buf + offset;
+	p->body_length = p->length - offset;
+	return p->length == len;
+}
+
+static void test_connect(void) {
+	uint8_t buf[64];
+	gateway_packet p;
+	uint16_t len;
+
+	len = mqttsn_msg_connect(buf, sizeof(buf), "ESP000A1B2C", 120, 1);
+	CHECK(gateway_parse(buf, len, &p));
+	CHECK_EQ(p.type, MQTTSN_MSG_TYPE_CONNECT);
+	CHECK_EQ(p.body[0], MQTTSN_FLAG_CLEAN_SESSION);
+	CHECK_EQ(p.body[1], MQTTSN_PROTOCOL_ID);
+	CHECK_EQ(p.body[2] << 8 | p.body[3], 120);
+	CHECK_EQ(p.body_length, 4 + 11);
+	CHECK(memcmp(p.body + 4, "ESP000A1B2C", 11) == 0);
+
+	// Client ids are 1 to 23 characters
+	CHECK_EQ(mqttsn_msg_connect(buf, sizeof(buf), "", 120, 1), 0);
+	CHECK_EQ(mqttsn_msg_connect(buf, sizeof(buf), "012345678901234567890123", 120, 1), 0);
+	CHECK_EQ(mqttsn_msg_connect(buf, 10, "ESP000A1B2C", 120, 1), 0);
+}
+
+static void test_publish(void) {
+	uint8_t buf[64];
+	gateway_packet p;
+	uint16_t len;
+
+	// QoS -1 to a pre-defined topic, no message id
+	len = mqttsn_msg_publish(buf, sizeof(buf), 1, 7, "{}", 2, MQTTSN_QOS_NO_CONNECT, 0);
+	CHECK(gateway_parse(buf, len, &p));
+	CHECK_EQ(p.type, MQTTSN_MSG_TYPE_PUBLISH);
+	CHECK_EQ(p.body[0], 0x60 | MQTTSN_TOPIC_TYPE_PREDEFINED);
+	CHECK_EQ(p.body[1] << 8 | p.body[2], 1);
+	CHECK_EQ(p.body[3] << 8 | p.body[4], 0);
+	CHECK_EQ(p.body_length, 5 + 2);
+	CHECK(memcmp(p.body + 5, "{}", 2) == 0);
+
+	// QoS 1 keeps the message id, retain is a flag
+	len = mqttsn_msg_publish(buf, sizeof(buf), 2, 0x1234, "x", 1, 1, 1);
+	CHECK(gateway_parse(buf, len, &p));
+	CHECK_EQ(p.body[0], 0x20 | MQTTSN_FLAG_RETAIN | MQTTSN_TOPIC_TYPE_PREDEFINED);
+	CHECK_EQ(p.body[1] << 8 | p.body[2], 2);
+	CHECK_EQ(p.body[3] << 8 | p.body[4], 0x1234);
+}
+
+static void test_long(void) {
+	uint8_t buf[PAYLOAD_SIZE + MQTTSN_PUBLISH_OVERHEAD];
+	char data[PAYLOAD_SIZE];
+	gateway_packet p;
+	uint16_t len;
+	int size;
+
+	memset(data, 'a', sizeof(data));
+	// The largest payload fits in PAYLOAD_SIZE + MQTTSN_PUBLISH_OVERHEAD
+	len = mqttsn_msg_publish(buf, sizeof(buf), 1, 0, data, sizeof(data), MQTTSN_QOS_NO_CONNECT, 0);
+	CHECK_EQ(len, sizeof(buf));
+	CHECK(gateway_parse(buf, len, &p));
+	CHECK_EQ(buf[0], 0x01);
+	CHECK_EQ(p.body_length, 5 + PAYLOAD_SIZE);
+	CHECK_EQ(mqttsn_msg_publish(buf, sizeof(buf) - 1, 1, 0, data, sizeof(data), MQTTSN_QOS_NO_CONNECT, 0), 0);
+
+	// Short and long length around 256
+	for (size = 240; size < 260; size++) {
+		len = mqttsn_msg_publish(buf, sizeof(buf), 1, 0, data, size, MQTTSN_QOS_NO_CONNECT, 0);
+		CHECK(gateway_parse(buf, len, &p));
+		CHECK_EQ(p.body_length, 5 + size);
+		CHECK_EQ(buf[0] == 0x01, 7 + size >= 256);
+	}
+}
+
+static void test_control(void) {
+	uint8_t buf[4];
+	gateway_packet p;
+
+	CHECK(gateway_parse(buf, mqttsn_msg_pingreq(buf, sizeof(buf)), &p));
+	CHECK_EQ(p.type, MQTTSN_MSG_TYPE_PINGREQ);
+	CHECK(gateway_parse(buf, mqttsn_msg_disconnect(buf, sizeof(buf)), &p));
+	CHECK_EQ(p.type, MQTTSN_MSG_TYPE_DISCONNECT);
+	CHECK_EQ(mqttsn_msg_pingreq(buf, 1), 0);
+}
+
+static void test_receive(void) {
+	static const uint8_t connack[] = { 3, MQTTSN_MSG_TYPE_CONNACK, MQTTSN_ACCEPTED };
+	static const uint8_t truncated[] = { 5, MQTTSN_MSG_TYPE_PUBACK, 0 };
+	static const uint8_t long_truncated[] = { 0x01, 0x01 };
+	uint16_t offset;
+
+	CHECK_EQ(mqttsn_get_type(connack, sizeof(connack), &offset), MQTTSN_MSG_TYPE_CONNACK);
+	CHECK_EQ(offset, 2);
+	CHECK_EQ(mqttsn_get_type(truncated, sizeof(truncated), &offset), -1);
+	CHECK_EQ(mqttsn_get_type(long_truncated, sizeof(long_truncated), &offset), -1);
+	CHECK_EQ(mqttsn_get_type(connack, 1, &offset), -1);
+}
+
+int main(void) {
+	test_connect();
+	test_publish();
+	test_long();
+	test_control();
+	test_receive();
+	CHECK_DONE("mqttsn");
+}
@@ -0,0 +1,302 @@
+/*
+ * Host tests of the 1-Wire master on a virtual bus. The cycle counter, the
+ * GPIO registers and the interrupt lock are stand-ins, a device model
+ * answers like a DS18B20 and logs every slot with its timing.
+ */
+#include <string.h>
+#include "check.h"
+#include "stub_sdk.h"
+#include "gpio.h"
+#include "ccount.h"
+#include "onewire.h"
+
+#define PIN			GPIO_ID_PIN(12)
+#define TICK		4			/* cycles per read of the counter */
+#define US			1000		/* ns */
+#define SLOTS_MAX	256
+
+struct slot {
+	uint32 low;			/* ns the master held the bus low */
+	uint32 gap;			/* ns from the falling edge of the slot before */
+	int32_t sample;		/* ns from the falling edge to the read, -1 if none */
+	bool locked;		/* interrupts off from the falling edge to the release */
+	bool sample_locked;
+};
+
+/* Master */
+static uint32 cycles = 0;
+static bool locked = FALSE;
+static bool out_low = FALSE;
+static bool enabled = FALSE;
+
+/* Device */
+static bool present = TRUE;
+static bool stuck = FALSE;
+static uint32 device_from = 0, device_until = 0;
+static uint8_t tx[8];
+static uint8_t tx_bits = 0, tx_bit = 0;
+static uint8_t rx[8];
+static uint8_t rx_bits = 0;
+
+/* Log */
+static struct slot slots[SLOTS_MAX];
+static int slot_count = 0;
+static uint32 fall = 0;
+static bool falling_locked;
+
+static uint32 now(void) {
+	return (uint64) cycles * US / stub_cpu_mhz;
+}
+
+static bool bus_high(void) {
+	uint32 t = now();
+	if (stuck || (enabled && out_low)) {
+		return FALSE;
+	}
+	return !(t >= device_from && t < device_until);
+}
+
+static void reset_bus(uint8_t mhz) {
+	stub_cpu_mhz = mhz;
+	cycles = 0;
+	locked = out_low = enabled = FALSE;
+	present = TRUE;
+	stuck = FALSE;
+	device_from = device_until = 0;
+	tx_bits = tx_bit = rx_bits = 0;
+	memset(rx, 0, sizeof(rx));
+	slot_count = 0;
+	fall = 0;
+}
+
+uint32_t OW_CCount(void) {
+	cycles += TICK;
+	return cycles;
+}
+
+void ets_intr_lock(void) {
+	locked = TRUE;
+}
+
+void ets_intr_unlock(void) {
+	locked = FALSE;
+}
+
+static void falling_edge(void) {
+	uint32 t = now();
+	struct slot *s = &slots[slot_count < SLOTS_MAX ? slot_count : SLOTS_MAX - 1];
+
+	s->gap = slot_count > 0 ? t - fall : 0;
+	s->sample = -1;
+	fall = t;
+	falling_locked = locked;
+}
+
+static void release(void) {
+	struct slot *s = &slots[slot_count < SLOTS_MAX ? slot_count : SLOTS_MAX - 1];
+	uint32 t = now();
+
+	s->low = t - fall;
+	s->locked = falling_locked && locked;
+	if (s->low >= 480 * US) {
+		// Presence pulse, 15-60 us after the release for 60-240 us
+		if (present) {
+			device_from = t + 30 * US;
+			device_until = t + 150 * US;
+		}
+	} else if (tx_bit < tx_bits) {
+		// A read slot: a 0 is held for 15-60 us from the falling edge
+		if (!((tx[tx_bit / 8] >> (tx_bit % 8)) & 1)) {
+			device_from = fall;
+			device_until = fall + 30 * US;
+		}
+		tx_bit++;
+	} else if (rx_bits < 64) {
+		// The device samples 15-60 us after the falling edge
+		if (s->low < 15 * US) {
+			rx[rx_bits / 8] |= 1 << (rx_bits % 8);
+		}
+		rx_bits++;
+	}
+	slot_count++;
+}
+
+void stub_gpio_write(uint32 reg, uint32 value) {
+	bool high;
+
+	if (!(value & (1 << PIN))) {
+		return;
+	}
+	high = bus_high();
+	switch (reg) {
+		case GPIO_OUT_W1TS_ADDRESS:
+			out_low = FALSE;
+			break;
+		case GPIO_OUT_W1TC_ADDRESS:
+			out_low = TRUE;
+			break;
+		case GPIO_ENABLE_W1TS_ADDRESS:
+			enabled = TRUE;
+			// The master must never drive the bus high
+			CHECK(out_low);
+			if (high) {
+				falling_edge();
+			}
+			break;
+		case GPIO_ENABLE_W1TC_ADDRESS:
+			if (enabled) {
+				enabled = FALSE;
+				release();
+			}
+			break;
+	}
+}
+
+uint32 stub_gpio_read(uint32 reg) {
+	struct slot *s = &slots[slot_count > 0 ? slot_count - 1 : 0];
+
+	CHECK_EQ(reg, GPIO_IN_ADDRESS);
+	if (slot_count > 0 && s->sample < 0) {
+		s->sample = now() - fall;
+		s->sample_locked = locked;
+	}
+	return bus_high() ? 1 << PIN : 0;
+}
+
+static void test_reset(uint8_t mhz) {
+	uint32 start;
+
+	reset_bus(mhz);
+	CHECK_EQ(OW_Reset(PIN), 0);
+	CHECK_EQ(slot_count, 1);
+	CHECK(slots[0].low >= 480 * US && slots[0].low < 500 * US);
+	// Sampled within the presence pulse, the slot is over on return
+	CHECK(slots[0].sample > slots[0].low + 30 * US && slots[0].sample < slots[0].low + 150 * US);
+	CHECK(now() - fall >= 960 * US);
+
+	reset_bus(mhz);
+	present = FALSE;
+	CHECK_EQ(OW_Reset(PIN), 1);
+
+	reset_bus(mhz);
+	start = now();
+	stuck = TRUE;
+	CHECK_EQ(OW_Reset(PIN), 2);
+	CHECK(now() - start >= 960 * US);
+}
+
+static void check_slots(int first, int count) {
+	int i;
+
+	for (i = first; i < first + count; i++) {
+		CHECK(slots[i].locked);
+		CHECK(slots[i].low >= 1 * US);
+		if (i > first) {
+			CHECK(slots[i].gap >= 70 * US && slots[i].gap < 80 * US);
+		}
+	}
+}
+
+static void test_write(uint8_t mhz) {
+	static const uint8_t data[] = { 0xA5, 0x3C, 0x01 };
+	int i;
+
+	reset_bus(mhz);
+	OW_Write(PIN, data, sizeof(data));
+	CHECK_EQ(slot_count, 24);
+	CHECK_EQ(rx_bits, 24);
+	CHECK(memcmp(rx, data, sizeof(data)) == 0);
+	check_slots(0, slot_count);
+	for (i = 0; i < slot_count; i++) {
+		// A 1 is released before the device samples, a 0 held past 60 us
+		if ((data[i / 8] >> (i % 8)) & 1) {
+			CHECK(slots[i].low < 15 * US);
+		} else {
+			CHECK(slots[i].low >= 60 * US && slots[i].low < 120 * US);
+		}
+	}
+	// LSB first, a single bit is the first slot
+	reset_bus(mhz);
+	OW_WriteByte(PIN, 0x01);
+	CHECK(slots[0].low < 15 * US);
+	CHECK(slots[1].low >= 60 * US);
+	CHECK(now() - fall >= 70 * US);
+}
+
+static void test_read(uint8_t mhz) {
+	static const uint8_t data[] = { 0x5A, 0xC3, 0x80 };
+	uint8_t buf[sizeof(data)];
+	int i;
+
+	reset_bus(mhz);
+	memcpy(tx, data, sizeof(data));
+	tx_bits = sizeof(data) * 8;
+	OW_Read(PIN, buf, sizeof(buf));
+	CHECK(memcmp(buf, data, sizeof(data)) == 0);
+	CHECK_EQ(tx_bit, tx_bits);
+	CHECK_EQ(slot_count, 24);
+	check_slots(0, slot_count);
+	for (i = 0; i < slot_count; i++) {
+		// Short low, sampled after the release and before 15 us
+		CHECK(slots[i].low < 15 * US);
+		CHECK(slots[i].sample > (int32_t) slots[i].low && slots[i].sample < 15 * US);
+		CHECK(slots[i].sample_locked);
+	}
+
+	reset_bus(mhz);
+	tx[0] = 0x01;
+	tx_bits = 8;
+	CHECK_EQ(OW_ReadBit(PIN), 1);
+	CHECK_EQ(OW_ReadBit(PIN), 0);
+}
+
+/*
+ * The bitwise CRC of Maxim AN27, which the nibble tables replace
+ */
+static uint8_t crc8_bitwise(const uint8_t *data, uint16_t len) {
+	uint8_t crc = 0, i, mix;
+
+	while (len--) {
+		uint8_t byte = *data++;
+		for (i = 0; i < 8; i++) {
+			mix = (crc ^ byte) & 0x01;
+			crc >>= 1;
+			if (mix) {
+				crc ^= 0x8C;
+			}
+			byte >>= 1;
+		}
+	}
+	return crc;
+}
+
+static void test_crc(void) {
+	// ROM code example of AN27, the CRC of the first 7 bytes is the last
+	static const uint8_t rom[] = { 0x02, 0x1C, 0xB8, 0x01, 0x00, 0x00, 0x00, 0xA2 };
+	uint8_t data[2];
+	int i;
+
+	CHECK_EQ(OW_Crc8(rom, 7), 0xA2);
+	CHECK_EQ(OW_Crc8(rom, 8), 0);
+	for (i = 0; i < 0x10000; i++) {
+		data[0] = i;
+		data[1] = i >> 8;
+		if (OW_Crc8(data, 2) != crc8_bitwise(data, 2)) {
+			CHECK_EQ(OW_Crc8(data, 2), crc8_bitwise(data, 2));
+			break;
+		}
+	}
+}
+
+int main(void) {
+	static const uint8_t mhz[] = { 80, 160 };
+	uint8_t i;
+
+	for (i = 0; i < sizeof(mhz); i++) {
+		test_reset(mhz[i]);
+		test_write(mhz[i]);
+		test_read(mhz[i]);
+	}
+	test_crc();
+	CHECK_DONE("onewire");
+}
@@ -0,0 +1,106 @@
+/*
+ * Host tests of the payload writer: formatting, and that a message that
+ * does not fit never writes past the buffer.
+ */
+#include <string.h>
+#include "check.h"
+#include "payload.h"
+
+#define CANARY	0x5A
+
+static void test_format(void) {
+	char buf[128];
+	PAYLOAD_Writer w;
+
+	PAYLOAD_Init(&w, buf, sizeof(buf));
+	PAYLOAD_Char(&w, '{');
+	PAYLOAD_Key(&w, "id");
+	PAYLOAD_Char(&w, '"');
+	PAYLOAD_Hex(&w, 0xA1B2C, 8);
+	PAYLOAD_Char(&w, '"');
+	PAYLOAD_Key(&w, "t");
+	PAYLOAD_Centi(&w, 2005);
+	PAYLOAD_Key(&w, "n");
+	PAYLOAD_Centi(&w, -5);
+	PAYLOAD_Key(&w, "min");
+	PAYLOAD_Int(&w, (int32_t) 0x80000000);
+	PAYLOAD_Key(&w, "max");
+	PAYLOAD_Uint(&w, 0xFFFFFFFF);
+	PAYLOAD_Key(&w, "h");
+	PAYLOAD_Char(&w, '[');
+	PAYLOAD_Int(&w, 0);
+	PAYLOAD_Char(&w, ']');
+	PAYLOAD_Key(&w, "s");
+	PAYLOAD_String(&w, "a\"b\\c\n");
+	PAYLOAD_Char(&w, '}');
+	CHECK(strcmp(buf, "{\"id\":\"000A1B2C\",\"t\":20.05,\"n\":-0.05,"
+			"\"min\":-2147483648,\"max\":4294967295,\"h\":[0],\"s\":\"a\\\"b\\\\c\"}") == 0);
+	CHECK_EQ(PAYLOAD_Length(&w), strlen(buf));
+}
+
+static void test_fit(void) {
+	char buf[8];
+	PAYLOAD_Writer w;
+
+	// One byte stays for the terminating zero
+	PAYLOAD_Init(&w, buf, sizeof(buf));
+	PAYLOAD_Raw(&w, "1234567", 7);
+	CHECK_EQ(PAYLOAD_Length(&w), 7);
+	CHECK(strcmp(buf, "1234567") == 0);
+
+	PAYLOAD_Init(&w, buf, sizeof(buf));
+	PAYLOAD_Raw(&w, "12345678", 8);
+	CHECK_EQ(PAYLOAD_Length(&w), -1);
+	CHECK_EQ(buf[0], '\0');
+}
+
+static void test_overflow(void) {
+	char buf[16 + 4];
+	PAYLOAD_Writer w;
+	uint8_t size, i;
+
+	// Every size up to the full message, the canary after it stays
+	for (size = 0; size <= 16; size++) {
+		memset(buf, CANARY, sizeof(buf));
+		PAYLOAD_Init(&w, buf, size);
+		PAYLOAD_Char(&w, '{');
+		PAYLOAD_Key(&w, "t");
+		PAYLOAD_Centi(&w, -1234);
+		PAYLOAD_Char(&w, '}');
+		for (i = size; i < sizeof(buf); i++) {
+			CHECK_EQ((uint8_t) buf[i], CANARY);
+		}
+		if (size > 12) {
+			CHECK_EQ(PAYLOAD_Length(&w), 12);
+			CHECK(strcmp(buf, "{\"t\":-12.34}") == 0);
+		} else {
+			CHECK_EQ(PAYLOAD_Length(&w), -1);
+		}
+		// What fit is a whole prefix and terminated
+		if (size > 0) {
+			CHECK(strlen(buf) < size);
+			CHECK(strncmp(buf, "{\"t\":-12.34}", strlen(buf)) == 0);
+		}
+	}
+}
+
+static void test_sticky(void) {
+	char buf[6];
+	PAYLOAD_Writer w;
+
+	// Nothing is appended after the first overflow, also if it would fit
+	PAYLOAD_Init(&w, buf, sizeof(buf));
+	PAYLOAD_Int(&w, 1234);
+	PAYLOAD_Int(&w, 5678);
+	PAYLOAD_Char(&w, '9');
+	CHECK_EQ(PAYLOAD_Length(&w), -1);
+	CHECK(strcmp(buf, "1234") == 0);
+}
+
+int main(void) {
+	test_format();
+	test_fit();
+	test_overflow();
+	test_sticky();
+	CHECK_DONE("payload");
+}
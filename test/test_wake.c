@@ -0,0 +1,62 @@
+/*
+ * Host tests of the wake schedule: a clock that runs off by a fixed skew
+ * is learned until the wakes hit their slots.
+ */
+#include <stdlib.h>
+#include "check.h"
+#include "stub_sdk.h"
+#include "wake.h"
+
+#define INTERVAL	60		/* s */
+#define AWAKE		100000	/* us from the wake to WAKE_Init */
+#define SLEEPS		40
+
+/*
+ * Returns by how many ms the last wake missed its slot
+ */
+static int32_t run(int32_t skew_ppm) {
+	int32_t error = 0;
+	int i;
+
+	stub_power_cycle();
+	stub_system_time = AWAKE;
+	stub_rtc_time = AWAKE;
+	WAKE_Init();
+	for (i = 0; i < SLEEPS; i++) {
+		stub_deep_sleep(WAKE_SleepTime(INTERVAL), skew_ppm, AWAKE);
+		WAKE_Init();
+		// Right after the wake, so WAKE_Offset is the miss plus AWAKE
+		error = WAKE_Offset() - AWAKE / 1000;
+	}
+	return error;
+}
+
+static void test_skew(void) {
+	CHECK(abs(run(0)) <= 1);
+	CHECK(abs(run(20000)) <= 1);
+	CHECK(abs(run(-20000)) <= 1);
+	CHECK(abs(run(500)) <= 1);
+}
+
+static void test_first_wake(void) {
+	int32_t error;
+
+	// Before the drift is learned the whole skew shows
+	stub_power_cycle();
+	stub_system_time = AWAKE;
+	stub_rtc_time = AWAKE;
+	WAKE_Init();
+	stub_deep_sleep(WAKE_SleepTime(INTERVAL), 0, AWAKE);
+	WAKE_Init();
+	stub_deep_sleep(WAKE_SleepTime(INTERVAL), 20000, AWAKE);
+	WAKE_Init();
+	error = WAKE_Offset() - AWAKE / 1000;
+	// 2% of a sleep of just under an interval
+	CHECK(error > 1150 && error < 1200);
+}
+
+int main(void) {
+	test_skew();
+	test_first_wake();
+	CHECK_DONE("wake");
+}
@@ -12,6 +12,7 @@
 #include "ets_sys.h"
 #include "osapi.h"
 #include "user_interface.h"
+#include "rfcal.h"
 
 /******************************************************************************
  * FunctionName : user_rf_cal_sector_set
@@ -72,8 +73,17 @@ user_rf_pre_init(void)
 
   // Process RF_CAL when wakeup.
   // Will high current
-  system_phy_set_rfoption(1);
+  // system_phy_set_rfoption(1);
+
+  // Full RF_CAL only every few wakes, see rfcal.h
+  system_phy_set_rfoption(RFCAL_PreInit());
 
   // Set Wi-Fi Tx Power, Unit: 0.25dBm, Range: [0, 82]
-  system_phy_set_max_tpw(82);
+  // system_phy_set_max_tpw(82);
+
+  // system_get_vdd33 needs byte 107 of esp_init_data_default.bin at 255,
+  // see REPORT_Supply
+
+  // Only as much as the last association needed, see rfcal.h
+  system_phy_set_max_tpw(RFCAL_TxPower());
 }
@@ -3,130 +3,562 @@
 #include <c_types.h>
 #include <mem.h>
 #include <os_type.h>
+#include <espconn.h>
 #include "user_config.h"
 #include "mqtt.h"
+#include "mqttsn.h"
 #include "wifi.h"
 #include "dht.h"
 #include "info.h"
+#include "payload.h"
+#include "report.h"
+#include "rfcal.h"
+#include "cpufreq.h"
+#include "wake.h"
+#include "epoch.h"
+#include "rtcmem.h"
+
+#ifdef DS1820_ENABLE
+#define SENSOR_COUNT	2
+#else
+#define SENSOR_COUNT	1
+#endif
 
 MQTT_Client mqttClient;
+#ifdef MQTTSN_ENABLE
+MQTTSN_Client mqttsnClient;
+#endif
 uint8 ttl = 0;
-const enum DHTType dhtType = DHT_TYPE;
-struct dht_sensor_data* measure;
+static struct dht_sensor sensors[SENSOR_COUNT];
+static BOOL measured = FALSE;
+static BOOL publish_pending = FALSE;
+static int32_t sample_offset = 0;
+static uint64 sample_time = 0;
+
+#define TOPIC_SIZE		128
+#define PAYLOAD_SIZE	384
+
+// The publish functions encode into buffers of their own
+#ifdef MQTTSN_ENABLE
+#if PAYLOAD_SIZE + MQTTSN_PUBLISH_OVERHEAD > MQTTSN_BUF_SIZE
+#error "MQTTSN_BUF_SIZE does not fit PAYLOAD_SIZE"
+#endif
+#else
+// Fixed header, remaining length, topic length and message id
+#if TOPIC_SIZE + PAYLOAD_SIZE + 7 > MQTT_BUF_SIZE
+#error "MQTT_BUF_SIZE does not fit TOPIC_SIZE and PAYLOAD_SIZE"
+#endif
+#endif
 
 
 #ifdef NO_SLEEP
+#ifndef NO_SLEEP_TYPE
+#define NO_SLEEP_TYPE	NONE_SLEEP_T
+#endif
+#ifndef NO_SLEEP_KEEPALIVE
+#define NO_SLEEP_KEEPALIVE	MQTT_KEEPALIVE
+#endif
+
 static ETSTimer call_timer;
+static BOOL reporting = FALSE;
+#else
+static ETSTimer budget_timer;
+static BOOL connected = FALSE;
+#if defined(MQTT_PIPELINE) && !defined(MQTTSN_ENABLE)
+static BOOL connect_pending = FALSE;
+#endif
 #endif
 
 static void ICACHE_FLASH_ATTR gotoSleep() {
 #ifndef NO_SLEEP
+	static ETSTimer epoch_timer;
+
+	if (!EPOCH_Valid() && EPOCH_Syncing()) {
+		// The offset is only saved if SNTP answers before the deep sleep,
+		// without it no wake ever has a time. EPOCH_SYNC_TIMEOUT bounds it.
+		os_timer_disarm(&epoch_timer);
+		os_timer_setfn(&epoch_timer, (os_timer_func_t *) gotoSleep, NULL);
+		os_timer_arm(&epoch_timer, 100, 0);
+		return;
+	}
+#ifdef MQTTSN_ENABLE
 	if (ttl <= 0) {
-		MQTT_Disconnect(&mqttClient);
+		MQTTSN_Disconnect(&mqttsnClient);
 	}
+#else
+	static BOOL flushing = FALSE;
+	uint32 sleep_us;
+
+	// Once per wake, the slot and the sleep option stay as computed
+	if (flushing) {
+		return;
+	}
+	flushing = TRUE;
+	// Sleeps once everything is delivered, or after MQTT_FLUSH_TIMEOUT,
+	// which replaces the radio budget
+	sleep_us = WAKE_SleepTime(REPORT_Interval());
+	os_timer_disarm(&budget_timer);
+	REPORT_SetSleepOption(sleep_us);
+	MQTT_FlushAndSleep(&mqttClient, sleep_us);
+#endif
 #endif
 }
 
+#ifndef NO_SLEEP
+static void ICACHE_FLASH_ATTR radioBudgetCb() {
+	uint32 sleep_us;
+
+	WARN("Radio-on budget of %d ms spent, giving up\r\n", RADIO_ON_BUDGET);
+	if (!connected) {
+		// Maybe the network moved, the next wake asks DHCP
+		WIFI_DropLease();
+	}
+	sleep_us = WAKE_SleepTime(REPORT_Interval());
+	REPORT_SetSleepOption(sleep_us);
+	system_deep_sleep(sleep_us);
+}
+#endif
+
+static void ICACHE_FLASH_ATTR mqttConnectedCb(uint32_t *args);
+static void ICACHE_FLASH_ATTR publish_dht22();
+static void ICACHE_FLASH_ATTR publish_diag();
+
 static void ICACHE_FLASH_ATTR wifiConnectCb(uint8_t status) {
 	if (status == STATION_GOT_IP) {
+		RFCAL_Rssi(wifi_station_get_rssi());
+		EPOCH_Sync();
+#ifdef MQTTSN_ENABLE
+		if (MQTTSN_QOS < 0) {
+			// QoS -1 needs no connection, publish right away
+			mqttConnectedCb(NULL);
+		} else {
+			MQTTSN_Connect(&mqttsnClient);
+		}
+#else
+#if defined(MQTT_PIPELINE) && !defined(NO_SLEEP)
+		// The reading goes out in the same segment as CONNECT, so CONNECT
+		// waits for it, DHT_SAMPLE_BUDGET bounds the wait
+		publish_dht22();
+		if (!measured) {
+			connect_pending = TRUE;
+			return;
+		}
+#endif
 		MQTT_Connect(&mqttClient);
+#endif
 	} else if (status != STATION_IDLE && status != STATION_CONNECTING) {
-		WARN("WIFI Connection failed. Shutting down\r\n");
-		ttl = 0;
-		gotoSleep();
+		// WIFI retries with backoff, RADIO_ON_BUDGET ends the wake
+		WARN("WIFI Connection failed, retrying\r\n");
+		RFCAL_LinkFailed();
 	}
 }
 
 
+static void ICACHE_FLASH_ATTR sampleDoneCb(struct dht_sensor *sensors, uint8_t count) {
+	uint8_t i;
+
+	measured = TRUE;
+	sample_offset = WAKE_Offset();
+	sample_time = RTC_GetTime();
+	for (i = 0; i < count; i++) {
+		if (!sensors[i].data.success) {
+			WARN("Error reading %s.\n", sensors[i].name);
+		}
+	}
+	// The first sensor paces the reports
+	REPORT_Sample(&sensors[0].data);
+	if (sensors[0].data.success) {
+		RFCAL_Temperature(sensors[0].data.temperature);
+	}
+#ifndef NO_SLEEP
+	if (!REPORT_RadioOn()) {
+		if (REPORT_Due(sensors, count)) {
+			INFO("Reading changed, restarting with the radio on\r\n");
+			REPORT_WakeRadio(sensors, count, sample_time, sample_offset);
+		} else {
+			uint32 sleep_us = WAKE_SleepTime(REPORT_Interval());
+			INFO("Nothing to report, going to deep sleep for %d seconds.\r\n", sleep_us / 1000000);
+			REPORT_SetSleepOption(sleep_us);
+			system_deep_sleep(sleep_us);
+		}
+		return;
+	}
+#endif
+	if (publish_pending) {
+		publish_pending = FALSE;
+#ifdef NO_SLEEP
+		if (REPORT_Due(sensors, count)) {
+			publish_dht22();
+		}
+		GPIO_OUTPUT_SET(LED_PIN, 1);
+		if (reporting) {
+			INFO("Next reading in %d seconds.\r\n", REPORT_Interval());
+			os_timer_arm(&call_timer, REPORT_Interval() * 1000, 0);
+		}
+#else
+		// Wakes with RF are only scheduled if there is something to send
+		publish_dht22();
+#if defined(MQTT_PIPELINE) && !defined(MQTTSN_ENABLE)
+		if (connect_pending) {
+			connect_pending = FALSE;
+			MQTT_Connect(&mqttClient);
+		}
+#endif
+#endif
+	}
+}
+
+/*
+ * Samples all sensors in the background, while WIFI connects
+ */
 static void ICACHE_FLASH_ATTR read_dht() {
-	measure = DHTRead();
-	if (!measure->success) {
-		WARN("Error reading temperature and humidity.\n");
+	measured = FALSE;
+	DHTSample(sensors, SENSOR_COUNT, DHT_SAMPLES, DHT_SAMPLE_BUDGET, sampleDoneCb);
+}
+
+static void ICACHE_FLASH_ATTR payload_reading(PAYLOAD_Writer *data, const struct dht_sensor *sensor) {
+	PAYLOAD_Key(data, "status");
+	if (sensor->data.success) {
+		PAYLOAD_String(data, "OK");
+		PAYLOAD_Key(data, "temperature");
+		PAYLOAD_Centi(data, sensor->data.temperature);
+		if (sensor->type != DS18B20) {
+			PAYLOAD_Key(data, "humidity");
+			PAYLOAD_Centi(data, sensor->data.humidity);
+		}
+	} else {
+		// No made up values, they would show up as real readings
+		PAYLOAD_String(data, "FAILED");
+	}
+}
+
+/*
+ * Writes the reading, the short form leaves out all but the values and the
+ * supply, returns the length or -1 if it does not fit
+ */
+static int ICACHE_FLASH_ATTR payload_dht22(char *buf, int size, BOOL full) {
+	PAYLOAD_Writer data;
+	uint8_t i;
+
+	PAYLOAD_Init(&data, buf, size);
+	PAYLOAD_Char(&data, '{');
+#ifdef MQTTSN_ENABLE
+	// The pre-defined topic does not tell the devices apart
+	PAYLOAD_Key(&data, "id");
+	PAYLOAD_Char(&data, '"');
+	PAYLOAD_Hex(&data, system_get_chip_id(), 8);
+	PAYLOAD_Char(&data, '"');
+#endif
+	if (EPOCH_Valid()) {
+		// From the cached offset, also if SNTP is still running
+		PAYLOAD_Key(&data, "time");
+		PAYLOAD_Uint(&data, EPOCH_At(sample_time));
+	} else {
+		// gotoSleep waits for SNTP, the next wake has the offset
+		DEBUG("No time yet, sending the reading without\r\n");
+	}
+	// The first sensor stays at the top, the others get an object each
+	payload_reading(&data, &sensors[0]);
+	for (i = 1; i < SENSOR_COUNT; i++) {
+		PAYLOAD_Key(&data, sensors[i].name);
+		PAYLOAD_Char(&data, '{');
+		payload_reading(&data, &sensors[i]);
+		PAYLOAD_Char(&data, '}');
 	}
+	if (REPORT_SupplyVoltage() > 0) {
+		PAYLOAD_Key(&data, "supply");
+		PAYLOAD_Int(&data, REPORT_SupplyVoltage());
+	}
+	if (REPORT_LastGasp()) {
+		PAYLOAD_Key(&data, "last_gasp");
+		PAYLOAD_Int(&data, 1);
+	}
+	if (full) {
+#ifndef NO_SLEEP
+		// Time of the reading relative to its slot, the slots are interval apart
+		PAYLOAD_Key(&data, "offset");
+		PAYLOAD_Int(&data, sample_offset);
+#endif
+		PAYLOAD_Key(&data, "interval");
+		PAYLOAD_Int(&data, REPORT_Interval());
+		PAYLOAD_Key(&data, "interval_min");
+		PAYLOAD_Int(&data, REPORT_INTERVAL_MIN);
+		PAYLOAD_Key(&data, "interval_max");
+		PAYLOAD_Int(&data, REPORT_INTERVAL_MAX);
+		PAYLOAD_Key(&data, "rf_cal");
+		PAYLOAD_Int(&data, RFCAL_Calibrated());
+		PAYLOAD_Key(&data, "rf_us");
+		PAYLOAD_Int(&data, RFCAL_Time());
+		PAYLOAD_Key(&data, "rssi");
+		PAYLOAD_Int(&data, wifi_station_get_rssi());
+		PAYLOAD_Key(&data, "tx_power");
+		PAYLOAD_Int(&data, RFCAL_TxPower());
+		PAYLOAD_Key(&data, "cpu_80");
+		PAYLOAD_Int(&data, CPUFREQ_Time(CPUFREQ_LOW) / 1000);
+		PAYLOAD_Key(&data, "cpu_160");
+		PAYLOAD_Int(&data, CPUFREQ_Time(CPUFREQ_HIGH) / 1000);
+	}
+	PAYLOAD_Char(&data, '}');
+	return PAYLOAD_Length(&data);
+}
+
+/*
+ * The topic id is used by MQTT-SN, the topic by MQTT which always uses QoS 0
+ */
+static BOOL ICACHE_FLASH_ATTR publish(const char *topic, uint16_t topic_id, const char *data, int len, int qos) {
+#ifdef MQTTSN_ENABLE
+	return MQTTSN_Publish(&mqttsnClient, topic_id, data, len, qos, 0);
+#else
+	return MQTT_Publish(&mqttClient, topic, data, len, 0, 0);
+#endif
 }
 
 static void ICACHE_FLASH_ATTR publish_dht22() {
-	//Submit data
-	char *topicBuf = (char*) os_zalloc(128);
-	char *id = (char*) os_zalloc(32);
-	os_sprintf(id, "%08X", system_get_chip_id());
+	//Submit data, MQTT_Publish and MQTTSN_Publish copy both buffers
+	char topicBuf[TOPIC_SIZE];
+	char dataBuf[PAYLOAD_SIZE];
+	PAYLOAD_Writer topic;
+	BOOL full = TRUE;
+	int len;
 
-	os_sprintf(topicBuf, "%s/%s/%s", MQTT_TOPIC_BASE, id, MQTT_CLIENT_TYPE);
-	char *dataBuf = (char*) os_zalloc(256);
-	int8_t len = 0;
-	if (measure->success) {
-		float lastTemp, lastHum;
-		lastTemp = measure->temperature;
-		lastHum = measure->humidity;
-		len += os_sprintf(dataBuf + len, "{\"status\":\"OK\"");
-		if (lastTemp < 0) {
-			lastTemp *= -1;
-			len += os_sprintf(dataBuf + len, ",\"temperature\":-%d.%d", (int) (lastTemp), (int) ((lastTemp - (int) lastTemp) * 100));
-		} else {
-			len += os_sprintf(dataBuf + len, ",\"temperature\":%d.%d", (int) (lastTemp), (int) ((lastTemp - (int) lastTemp) * 100));
-		}
-		if (dhtType != DS18B20) {
-			len += os_sprintf(dataBuf + len, ",\"humidity\":%d.%d", (int) (lastHum), (int) ((lastHum - (int) lastHum) * 100));
+	if (!measured) {
+		// sampleDoneCb publishes
+		publish_pending = TRUE;
+		return;
+	}
+
+	CPUFREQ_Boost(CPUFREQ_ENCODE);
+	PAYLOAD_Init(&topic, topicBuf, sizeof(topicBuf));
+	PAYLOAD_Raw(&topic, MQTT_TOPIC_BASE "/", sizeof(MQTT_TOPIC_BASE));
+	PAYLOAD_Hex(&topic, system_get_chip_id(), 8);
+	PAYLOAD_Raw(&topic, "/" MQTT_CLIENT_TYPE, sizeof(MQTT_CLIENT_TYPE));
+
+	len = payload_dht22(dataBuf, sizeof(dataBuf), full);
+	if (len < 0) {
+		WARN("Payload does not fit, sending the short form\r\n");
+		full = FALSE;
+		len = payload_dht22(dataBuf, sizeof(dataBuf), full);
+	}
+	if (len < 0 || PAYLOAD_Length(&topic) < 0) {
+		ERROR("Payload does not fit\r\n");
+		CPUFREQ_Release(CPUFREQ_ENCODE);
+		gotoSleep();
+		return;
+	}
+	INFO("%s\r\n", dataBuf);
+	if (REPORT_DiagDue()) {
+		// Before the reading, a QoS 1 MQTT-SN publish blocks the client
+		publish_diag();
+	}
+	ttl++;
+	while (!publish(topicBuf, MQTTSN_TOPIC_ID, dataBuf, len, MQTTSN_QOS)) {
+		if (!full) {
+			ERROR("Publish failed\r\n");
+			ttl--;
+			CPUFREQ_Release(CPUFREQ_ENCODE);
+			gotoSleep();
+			return;
 		}
-	} else {
-		len += os_sprintf(dataBuf + len, "{\"status\":\"FAILED\"");
-		len += os_sprintf(dataBuf + len, ",\"temperature\":0.0");
-		if (dhtType != DS18B20) {
-			len += os_sprintf(dataBuf + len, ",\"humidity\":0.0");
+		WARN("Publish failed, retrying with the short form\r\n");
+		full = FALSE;
+		len = payload_dht22(dataBuf, sizeof(dataBuf), full);
+	}
+	CPUFREQ_Release(CPUFREQ_ENCODE);
+}
+
+/*
+ * Writes the health counters, the short form leaves out the pulse statistics
+ */
+static int ICACHE_FLASH_ATTR payload_diag(char *buf, int size, BOOL full) {
+	PAYLOAD_Writer data;
+	uint8_t i, bin;
+
+	PAYLOAD_Init(&data, buf, size);
+	PAYLOAD_Char(&data, '{');
+#ifdef MQTTSN_ENABLE
+	PAYLOAD_Key(&data, "id");
+	PAYLOAD_Char(&data, '"');
+	PAYLOAD_Hex(&data, system_get_chip_id(), 8);
+	PAYLOAD_Char(&data, '"');
+#endif
+	for (i = 0; i < SENSOR_COUNT; i++) {
+		const struct dht_stats *stats = &sensors[i].stats;
+		PAYLOAD_Key(&data, sensors[i].name);
+		PAYLOAD_Char(&data, '{');
+		PAYLOAD_Key(&data, "attempts");
+		PAYLOAD_Int(&data, stats->attempts);
+		PAYLOAD_Key(&data, "successes");
+		PAYLOAD_Int(&data, stats->successes);
+		PAYLOAD_Key(&data, "checksum");
+		PAYLOAD_Int(&data, stats->checksum);
+		PAYLOAD_Key(&data, "short");
+		PAYLOAD_Int(&data, stats->short_reads);
+		PAYLOAD_Key(&data, "resets");
+		PAYLOAD_Int(&data, stats->resets);
+		PAYLOAD_Key(&data, "retries");
+		PAYLOAD_Int(&data, stats->retries);
+		if (full && sensors[i].type != DS18B20) {
+			PAYLOAD_Key(&data, "histogram");
+			PAYLOAD_Char(&data, '[');
+			for (bin = 0; bin < DHT_HISTOGRAM_BINS; bin++) {
+				if (bin > 0) {
+					PAYLOAD_Char(&data, ',');
+				}
+				PAYLOAD_Int(&data, stats->histogram[bin]);
+			}
+			PAYLOAD_Char(&data, ']');
+			PAYLOAD_Key(&data, "threshold");
+			PAYLOAD_Int(&data, stats->threshold);
+			PAYLOAD_Key(&data, "margin");
+			PAYLOAD_Int(&data, stats->margin);
 		}
+		PAYLOAD_Char(&data, '}');
+	}
+	PAYLOAD_Char(&data, '}');
+	return PAYLOAD_Length(&data);
+}
+
+/*
+ * Publishes the health counters of the sensors on the diag topic
+ */
+static void ICACHE_FLASH_ATTR publish_diag() {
+	char topicBuf[TOPIC_SIZE];
+	char dataBuf[PAYLOAD_SIZE];
+	PAYLOAD_Writer topic;
+	BOOL full = TRUE;
+	int len;
+
+	PAYLOAD_Init(&topic, topicBuf, sizeof(topicBuf));
+	PAYLOAD_Raw(&topic, MQTT_TOPIC_BASE "/", sizeof(MQTT_TOPIC_BASE));
+	PAYLOAD_Hex(&topic, system_get_chip_id(), 8);
+	PAYLOAD_Raw(&topic, "/" MQTT_DIAG_TYPE, sizeof(MQTT_DIAG_TYPE));
+
+	len = payload_diag(dataBuf, sizeof(dataBuf), full);
+	if (len < 0) {
+		WARN("Diagnostics do not fit, sending the short form\r\n");
+		full = FALSE;
+		len = payload_diag(dataBuf, sizeof(dataBuf), full);
+	}
+	if (len < 0 || PAYLOAD_Length(&topic) < 0) {
+		ERROR("Diagnostics do not fit\r\n");
+		return;
 	}
-	len += os_sprintf(dataBuf + len, "}");
-	dataBuf[len] = '\0';
 	INFO("%s\r\n", dataBuf);
 	ttl++;
-	MQTT_Publish(&mqttClient, topicBuf, dataBuf, len, 0, 0);
-	os_free(id);
-	os_free(topicBuf);
-	os_free(dataBuf);
+	// QoS -1 over MQTT-SN, the published callback comes once it is sent
+	while (!publish(topicBuf, MQTTSN_DIAG_TOPIC_ID, dataBuf, len, -1)) {
+		if (!full) {
+			// Stays due, the next report tries again
+			ERROR("Publishing diagnostics failed\r\n");
+			ttl--;
+			return;
+		}
+		WARN("Publishing diagnostics failed, retrying with the short form\r\n");
+		full = FALSE;
+		len = payload_diag(dataBuf, sizeof(dataBuf), full);
+	}
+	REPORT_DiagSent();
 }
 
 #ifdef NO_SLEEP
 static void ICACHE_FLASH_ATTR publish_dht22_cb() {
+	// Fresh reading for every report, sampleDoneCb publishes
 	GPIO_OUTPUT_SET(LED_PIN, 0);
-	publish_dht22();
-	GPIO_OUTPUT_SET(LED_PIN, 1);
+	REPORT_Supply(system_get_vdd33() * 1000 / 1024);
+	EPOCH_Sync();
+	publish_pending = TRUE;
+	read_dht();
 }
 #endif
 
 static void ICACHE_FLASH_ATTR mqttConnectedCb(uint32_t *args) {
 	INFO("MQTT: Connected\r\n");
+#ifndef MQTTSN_ENABLE
 	mqttClient = *(MQTT_Client*) args;
+#endif
+#ifndef NO_SLEEP
+	connected = TRUE;
+#endif
 
 #ifdef NO_SLEEP
-	INFO("Starting timer with %d ms intervals.\r\n",REPORT_INTERVAL);
+	// sampleDoneCb arms the timer with the next interval
+	reporting = TRUE;
 	os_timer_disarm(&call_timer);
 	os_timer_setfn(&call_timer, (os_timer_func_t *) publish_dht22_cb, NULL);
-	os_timer_arm(&call_timer, REPORT_INTERVAL, 1);
 	publish_dht22_cb();
-#else
+#elif !defined(MQTT_PIPELINE) || defined(MQTTSN_ENABLE)
 	publish_dht22();
 #endif
 }
 
 static void ICACHE_FLASH_ATTR mqttDisconnectedCb(uint32_t *args) {
-	MQTT_Client* client = (MQTT_Client*) args;
 	DEBUG("MQTT: Disconnected\r\n");
 #ifdef NO_SLEEP
+	reporting = FALSE;
 	os_timer_disarm(&call_timer);
+#elif defined(MQTTSN_ENABLE)
+	static BOOL sleeping = FALSE;
+	uint32 sleep_us;
+
+	// After a timeout the socket closes as well
+	if (sleeping) {
+		return;
+	}
+	sleeping = TRUE;
+	sleep_us = WAKE_SleepTime(REPORT_Interval());
+	INFO("Going to deep sleep for %d seconds.\r\n", sleep_us / 1000000);
+	REPORT_SetSleepOption(sleep_us);
+	system_deep_sleep(sleep_us);
 #else
-	INFO("Going to deep sleep for %d seconds.\r\n", (DEEP_SLEEP/1000000));
-	system_deep_sleep_set_option(1);
-	system_deep_sleep(DEEP_SLEEP);
+	gotoSleep();
 #endif
 }
 
 static void ICACHE_FLASH_ATTR mqttPublishedCb(uint32_t *args) {
+#ifndef MQTTSN_ENABLE
 	MQTT_Client* client = (MQTT_Client*) args;
+#endif
 	DEBUG("MQTT: Published\r\n");
+	// The broker was reached, so was its next hop
+#ifdef MQTTSN_ENABLE
+	WIFI_CacheNextHop(mqttsnClient.pCon->proto.udp->remote_ip);
+#else
+	WIFI_CacheNextHop(client->pCon->proto.tcp->remote_ip);
+#endif
+	if (measured) {
+		REPORT_Sent(sensors, SENSOR_COUNT);
+	}
 	ttl--;
 	gotoSleep();
 }
 
+#ifdef MQTTSN_ENABLE
+static void ICACHE_FLASH_ATTR mqttTimeoutCb(uint32_t *args) {
+	// Rejected or unanswered, the gateway will not take it this wake
+	WARN("MQTT-SN: No answer or rejected, giving up\r\n");
+#ifndef NO_SLEEP
+	mqttDisconnectedCb(args);
+#endif
+}
+
+static void ICACHE_FLASH_ATTR mqtt_init(void) {
+	DEBUG("INIT MQTT-SN\r\n");
+	//If WIFI is connected, the reading gets published (see wifiConnectCb)
+	MQTTSN_InitConnection(&mqttsnClient, MQTTSN_HOST, MQTTSN_PORT);
+
+	char *clientId = (char*) os_zalloc(64);
+	os_sprintf(clientId, "%s%08X", MQTT_CLIENT_ID, system_get_chip_id());
+	if (!MQTTSN_InitClient(&mqttsnClient, clientId, MQTT_KEEPALIVE, MQTT_CLEAN_SESSION)) {
+		ERROR("Could not initialize MQTT-SN client");
+	}
+	os_free(clientId);
+
+	MQTTSN_OnConnected(&mqttsnClient, mqttConnectedCb);
+	MQTTSN_OnDisconnected(&mqttsnClient, mqttDisconnectedCb);
+	MQTTSN_OnPublished(&mqttsnClient, mqttPublishedCb);
+	MQTTSN_OnTimeout(&mqttsnClient, mqttTimeoutCb);
+}
+#else
 static void ICACHE_FLASH_ATTR mqtt_init(void) {
 	DEBUG("INIT MQTT\r\n");
 	//If WIFI is connected, MQTT gets connected (see wifiConnectCb)
@@ -139,7 +571,12 @@ static void ICACHE_FLASH_ATTR mqtt_init(void) {
 	os_sprintf(id, "%08X", system_get_chip_id());
 
 	//id will be copied by MQTT_InitLWT
+#ifdef NO_SLEEP
+	// The session stays up between reports, pings are the only traffic
+	if (!MQTT_InitClient(&mqttClient, clientId, id, id, NO_SLEEP_KEEPALIVE, MQTT_CLEAN_SESSION)) {
+#else
 	if (!MQTT_InitClient(&mqttClient, clientId, id, id, MQTT_KEEPALIVE, MQTT_CLEAN_SESSION)) {
+#endif
 		ERROR("Could not initialize MQTT client");
 	}
 	os_free(id);
@@ -148,8 +585,12 @@ static void ICACHE_FLASH_ATTR mqtt_init(void) {
 	MQTT_OnConnected(&mqttClient, mqttConnectedCb);
 	MQTT_OnDisconnected(&mqttClient, mqttDisconnectedCb);
 	MQTT_OnPublished(&mqttClient, mqttPublishedCb);
+#if defined(MQTT_PIPELINE) && !defined(NO_SLEEP)
+	MQTT_SetPipelining(&mqttClient, MQTT_PIPELINE);
+#endif
 
 }
+#endif
 
 static void ICACHE_FLASH_ATTR app_init(void) {
 	print_info();
@@ -159,19 +600,51 @@ static void ICACHE_FLASH_ATTR app_init(void) {
 #else
 	INFO("Mode: Low power consumption\r\n");
 #endif
-	DHTInit(dhtType);
-	read_dht();
+#ifndef NO_SLEEP
+	WAKE_Init();
+#endif
+	REPORT_Init();
+	DHTInit(&sensors[0], DHT_TYPE, DHT_NAME, DHT_PIN, DHT_MUX, DHT_FUNC);
+#ifdef DS1820_ENABLE
+	DHTInit(&sensors[1], DS18B20, DS1820_NAME, DS1820_PIN, DS1820_MUX, DS1820_FUNC);
+#endif
+	if (REPORT_RadioOn()) {
+		// Only valid with RF on, wakes without keep the last value
+		REPORT_Supply(system_get_vdd33() * 1000 / 1024);
+	}
+	if (REPORT_Carried(sensors, SENSOR_COUNT, &sample_time, &sample_offset)) {
+		// The wake before only reset to get RF, its reading goes out as is
+		INFO("Sending the reading of the last wake\r\n");
+		DHTLoadStats(sensors, SENSOR_COUNT);
+		measured = TRUE;
+	} else {
+		read_dht();
+	}
+	if (!REPORT_RadioOn()) {
+		// sampleDoneCb decides if the reading is worth the radio
+		return;
+	}
 	mqtt_init();
 
-	struct ip_info info;
-	IP4_ADDR(&info.ip, 192, 168, 13, (system_get_chip_id() % 72) + 2);
-	IP4_ADDR(&info.gw, 192, 168, 13, 1);
-	IP4_ADDR(&info.netmask, 255, 255, 255, 0);
-
-	WIFI_Connect_IP(STA_SSID, STA_PASS, &info, wifiConnectCb);
+#ifdef NO_SLEEP
+	// Before connecting, the station only wakes for every
+	// NO_SLEEP_LISTEN_INTERVAL-th DTIM beacon and the CPU idles in between
+	wifi_set_sleep_type(NO_SLEEP_TYPE);
+#ifdef NO_SLEEP_LISTEN_INTERVAL
+	wifi_set_sleep_level(MAX_SLEEP_T);
+	wifi_set_listen_interval(NO_SLEEP_LISTEN_INTERVAL);
+#endif
+#else
+	os_timer_disarm(&budget_timer);
+	os_timer_setfn(&budget_timer, (os_timer_func_t *) radioBudgetCb, NULL);
+	os_timer_arm(&budget_timer, RADIO_ON_BUDGET, 0);
+#endif
+	WIFI_Connect_Lease(STA_SSID, STA_PASS, wifiConnectCb);
 }
 
 void user_init(void) {
+	// Before anything of the application, it would count as RF init
+	RFCAL_Init();
 	system_init_done_cb(app_init);
 }
 